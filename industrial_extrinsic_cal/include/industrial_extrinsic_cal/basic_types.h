@@ -118,18 +118,20 @@ typedef struct
   std::vector<Point3d> pts; /**< an array of points expressed relative to Pose p. */
   bool fixed_pose; /**< is the location of the target known? **/
   bool fixed_points; /**< are the locations of the points within the target known */
+  int target_id; /**< index of the target in the job's target table, set when a scene commands its observation */
 } Target;
 
-/*! \brief An observation is the x,y image location of a target's point in an image*/
+/*! \brief An observation is the x,y image location of a target's point in an image,
+ *   it holds no pointers so copying observations never touches a reference count */
 typedef struct
 {
-  boost::shared_ptr<Target> target; /**< pointer to target who's point is observed */
+  int target_index; /**< target_id of the target who's point is observed */
   int point_id; /**< point's id in target's point array */
   double image_loc_x; /**< target point was found at image location x */
   double image_loc_y; /**< target point image location y */
 } Observation;
 
-/*! \brief A vector of observations made by a single camera of posibly multiple targets */
+/*! \brief A plain array of observations made by a single camera of posibly multiple targets */
 typedef struct
 {
   std::vector<Observation> observations;
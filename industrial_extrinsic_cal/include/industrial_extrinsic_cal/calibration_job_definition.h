@@ -28,32 +28,86 @@
 #include <industrial_extrinsic_cal/ceres_blocks.h>
 #include <industrial_extrinsic_cal/ros_camera_observer.h>
 #include <industrial_extrinsic_cal/ceres_costs_utils.hpp>
+#include <industrial_extrinsic_cal/solver_monitor.h>
+#include <industrial_extrinsic_cal/solver_planner.h>
 #include <boost/shared_ptr.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include "ceres/ceres.h"
 #include "ceres/rotation.h"
 #include <ros/console.h>
 #include <yaml-cpp/yaml.h>
 #include <fstream>
 #include <iostream>
+#include <deque>
+#include <map>
 
 namespace industrial_extrinsic_cal
 {
 
+/**
+ *  @brief strategies used by CalibrationJob::runOptimization() to build and solve the problem
+ */
+namespace optimization_modes
+{
+enum optimization_modes_
+{
+  PerSceneSolve = 0, /*!< re-adds each scene's observations and solves once per camera in every scene */
+  SingleSolve = 1, /*!< adds every observation to the problem exactly once and solves once */
+  ComponentSolve = 2 /*!< solves each independent group of cameras and targets as its own problem in parallel */
+};
+}
+typedef optimization_modes::optimization_modes_ OptimizationMode;
+
+/*! @brief block indexes of the camera extrinsics and target pose and the scene id, identifying everything one camera
+ *         saw of one target in one scene */
+typedef std::pair<std::pair<int, int>, int> ViewKey;
+
+/*! @brief a connected set of observations sharing no parameter blocks with any other set */
+typedef struct
+{
+  std::vector<int> observations; /*!< rows of every observation in this component */
+  boost::shared_ptr<ceres::Problem> problem; /*!< problem built from the observations */
+  double build_time; /*!< seconds spent adding residual blocks */
+  double solve_time; /*!< seconds spent in ceres::Solve() */
+  size_t num_pruned; /*!< observations removed as outliers */
+  bool solved; /*!< the solve ended with a usable solution */
+} ProblemComponent;
+
+/*! @brief a scene between the trigger of its cameras and the registration of their observations */
+typedef struct
+{
+  size_t scene; /*!< position of the scene in the scene list */
+  std::vector<boost::shared_ptr<Camera> > cameras; /*!< cameras triggered for the scene, one for each observer */
+  std::vector<boost::shared_ptr<TriggerCompletion> > triggers; /*!< trigger of each camera */
+  std::vector<boost::shared_ptr<TriggerCompletion> > detections; /*!< completed once each camera's observations are collected */
+  std::vector<TriggerResult> results; /*!< how the trigger of each camera ended */
+  std::vector<CameraObservations> observations; /*!< observations of each camera, the buffers are kept for reuse */
+  boost::system_time deadline; /*!< time by which every camera has to complete its trigger */
+} SceneAcquisition;
+
 /*! @brief defines and executes the calibration script */
 class CalibrationJob
 {
 public:
   /** @brief constructor */
   CalibrationJob(std::string camera_fn, std::string target_fn, std::string caljob_fn) :
-      camera_def_file_name_(camera_fn), target_def_file_name_(target_fn), caljob_def_file_name_(caljob_fn)
+      camera_def_file_name_(camera_fn), target_def_file_name_(target_fn), caljob_def_file_name_(caljob_fn),
+      problem_(new ceres::Problem()), optimization_mode_(optimization_modes::SingleSolve), num_solves_(0),
+      build_time_(0.0), solve_time_(0.0), num_threads_(boost::thread::hardware_concurrency()),
+      use_analytic_jacobians_(false), use_batched_residuals_(false), num_observed_scenes_(0), has_solution_(false),
+      covariance_time_(0.0), prune_outliers_(false), outlier_threshold_(2.0), num_pruned_(0),
+      auto_tune_solver_(false), estimate_target_poses_(false), schur_ordered_(false),
+      linear_solver_type_(ceres::DENSE_SCHUR), camera_timeout_(10.0),
+      pipeline_depth_(2), stop_detection_(false)
   {
   }
   ;
 
-  /** @brief default destructor */
+  /** @brief destructor, stops and joins the detection workers */
   ~CalibrationJob()
   {
+    stopDetectionWorkers();
   }
   ;
 
@@ -72,6 +126,29 @@ public:
    */
   bool run();
 
+  /** @brief re-solves the job starting from the last solution, collecting only the scenes that were
+   *         appended since the last run. The parameter blocks and the observations of earlier scenes are kept.
+   *         Runs the complete job when there is no previous solution.
+   * @return true if successful
+   */
+  bool runIncremental();
+
+  /** @brief appends the scenes of another calibration job file to this job
+   *  the scene ids of the file are offset past those already in the job, so the same file may be appended
+   *  once for each recalibration, every camera and target it names must be defined by the job's files
+   *  @param caljob_fn the file, its scene ids must be unique within the file
+   *  @return true if successful, false leaves the job's scenes unchanged
+   */
+  bool appendScenes(const std::string &caljob_fn);
+
+  /**
+   * @brief true once an optimization succeeded, runIncremental() then warm starts from its result
+   */
+  bool hasSolution() const
+  {
+    return has_solution_;
+  }
+
   /** @brief removes all camera observers from job
    *  @return true if successful
    */
@@ -98,11 +175,16 @@ public:
 
   /**
    * @brief get the private member original_extrinsics_
-   * @return a parameter block of the original extrinsics of calibration_job
+   * @return a parameter block of the original extrinsics of calibration_job, valid as long as the job
    */
   const std::vector<P_BLOCK> getOriginalExtrinsics() const
   {
-    return original_extrinsics_;
+    std::vector<P_BLOCK> original_extrinsics;
+    for (int i = 0; i < original_extrinsics_.size(); i++)
+    {
+      original_extrinsics.push_back(const_cast<P_BLOCK>(&original_extrinsics_[i][0]));
+    }
+    return original_extrinsics;
   }
 
   /**
@@ -114,6 +196,211 @@ public:
     return target_pose_;
   }
 
+  /**
+   * @brief selects how runOptimization() builds and solves the problem
+   * @param mode PerSceneSolve, SingleSolve (default) or ComponentSolve
+   */
+  void setOptimizationMode(OptimizationMode mode)
+  {
+    optimization_mode_ = mode;
+  }
+
+  /**
+   * @brief get the private member optimization_mode_
+   * @return the strategy used by runOptimization()
+   */
+  OptimizationMode getOptimizationMode() const
+  {
+    return optimization_mode_;
+  }
+
+  /**
+   * @brief sets the number of worker threads used by the ComponentSolve mode
+   * @param num_threads number of threads, values below 1 use a single thread
+   */
+  void setNumThreads(int num_threads)
+  {
+    num_threads_ = num_threads;
+  }
+
+  /**
+   * @brief selects the cost functions created when the problem is built
+   * @param use_analytic true for the hand derived jacobians, false for automatic differentiation (default)
+   */
+  void setAnalyticJacobians(bool use_analytic)
+  {
+    use_analytic_jacobians_ = use_analytic;
+  }
+
+  /**
+   * @brief selects one residual block per observed point or one per view of a target
+   * @param use_batched true to add all points a camera saw of a target in a scene as a single
+   *        residual block with analytic jacobians, false for one block per point (default)
+   */
+  void setBatchedResiduals(bool use_batched)
+  {
+    use_batched_residuals_ = use_batched;
+  }
+
+  /**
+   * @brief enables the outlier pruning pipeline of the SingleSolve and ComponentSolve modes: a quick solve
+   *        under a Cauchy loss, removal of the observations whose reprojection error exceeds the threshold and of
+   *        whole views where most points do, then the final solve on the remaining observations
+   * @param prune true to remove outliers before the final solve, false to use every observation (default)
+   * @param pixel_threshold reprojection error in pixels above which an observation is an outlier,
+   *        also the scale of the Cauchy loss
+   */
+  void setOutlierPruning(bool prune, double pixel_threshold)
+  {
+    prune_outliers_ = prune;
+    outlier_threshold_ = pixel_threshold;
+  }
+
+  /**
+   * @brief number of observations removed as outliers by the last runOptimization()
+   */
+  size_t getNumPruned() const
+  {
+    return num_pruned_;
+  }
+
+  /**
+   * @brief times the candidate linear solvers on the first SingleSolve problem and reuses the fastest,
+   *        cached under the calibration job file name, for every later solve of the same job
+   * @param auto_tune true to time the candidates, false to choose from the problem structure alone (default)
+   */
+  void setAutoTuneSolver(bool auto_tune)
+  {
+    auto_tune_solver_ = auto_tune;
+  }
+
+  /**
+   * @brief estimates the pose of a moving target in each scene along with the cameras, in the SingleSolve and
+   *        ComponentSolve modes. The residuals then place the points by their target pose
+   *        (TargetPoseCameraReprjErrorNoDistortion), the default costs take the target frame as the world frame.
+   *        The first pose of each moving target in a problem stays at its initial value and anchors the frame,
+   *        so the moving targets should be observed by static cameras. Static target poses are always held
+   *        constant. The free poses give the Schur solvers blocks to eliminate, they are solved under the
+   *        ordering of CeresBlocks::buildSchurOrdering(). Every point gets its own residual block.
+   * @param estimate true to estimate the moving target poses, false to hold every target pose constant (default)
+   */
+  void setEstimateTargetPoses(bool estimate)
+  {
+    estimate_target_poses_ = estimate;
+  }
+
+  /**
+   * @brief true if the last SingleSolve was solved under the explicit Schur ordering of its blocks,
+   *        without free target poses there is nothing to eliminate and the planner picks a non Schur solver
+   */
+  bool usedSchurOrdering() const
+  {
+    return schur_ordered_;
+  }
+
+  /**
+   * @brief the linear solver the last SingleSolve was solved with, as planned or auto-tuned
+   */
+  ceres::LinearSolverType getLinearSolverType() const
+  {
+    return linear_solver_type_;
+  }
+
+  /**
+   * @brief longest time a scene waits for its cameras after triggering them, a camera which does not
+   *        complete in time fails the scene and is not triggered again until its pending trigger returns
+   * @param seconds time allowed from the trigger to the observations of every camera (default 10)
+   */
+  void setCameraTimeout(double seconds)
+  {
+    camera_timeout_ = seconds;
+  }
+
+  /**
+   * @brief number of scenes which may be in flight at once, a scene is triggered while the observations of the
+   *        earlier ones are still being detected, as long as it does not need one of their cameras
+   * @param depth scenes in flight, 1 observes one scene after another (default 2)
+   */
+  void setPipelineDepth(size_t depth)
+  {
+    pipeline_depth_ = depth;
+  }
+
+  /**
+   * @brief the monitor recording every solve, configures the time budget, the relative improvement
+   *        stop and the progress topic, and holds the iterations of the last runOptimization()
+   */
+  SolverMonitor& getSolverMonitor()
+  {
+    return solver_monitor_;
+  }
+
+  /**
+   * @brief number of times ceres::Solve() was called by the last runOptimization()
+   */
+  int getNumSolves() const
+  {
+    return num_solves_;
+  }
+
+  /**
+   * @brief wall clock seconds spent adding residual blocks during the last runOptimization()
+   */
+  double getBuildTime() const
+  {
+    return build_time_;
+  }
+
+  /**
+   * @brief wall clock seconds spent in ceres::Solve() during the last runOptimization()
+   */
+  double getSolveTime() const
+  {
+    return solve_time_;
+  }
+
+  /**
+   * @brief computes the covariance of parameter blocks estimated by the last runOptimization()
+   *        using the sparse algorithm, only the requested diagonal blocks are formed
+   * @param blocks the 6 parameter pose blocks, e.g. from getExtrinsics() or getTargetPose()
+   * @param covariances output, one row major 6x6 matrix per requested block, zeros for blocks which
+   *        were not optimized or are held constant
+   * @return true if successful, false if the covariance of any problem could not be computed
+   */
+  bool computeCovariance(const std::vector<P_BLOCK> &blocks, std::vector<std::vector<double> > &covariances);
+
+  /**
+   * @brief computes the covariance of every block returned by getExtrinsics() and getTargetPose(),
+   *        the target poses only have one when they are estimated, see setEstimateTargetPoses()
+   * @return true if successful
+   */
+  bool computeResultCovariance();
+
+  /**
+   * @brief row major 6x6 covariances from computeResultCovariance(), one per getExtrinsics() entry
+   */
+  const std::vector<std::vector<double> >& getExtrinsicsCovariance() const
+  {
+    return extrinsics_covariance_;
+  }
+
+  /**
+   * @brief row major 6x6 covariances from computeResultCovariance(), one per getTargetPose() entry,
+   *        zeros for the poses held constant
+   */
+  const std::vector<std::vector<double> >& getTargetPoseCovariance() const
+  {
+    return target_pose_covariance_;
+  }
+
+  /**
+   * @brief wall clock seconds spent in the last computeCovariance()
+   */
+  double getCovarianceTime() const
+  {
+    return covariance_time_;
+  }
+
   const std::vector<std::string>& getCameraIntermediateFrame() const
   {
     return camera_intermediate_frames_;
@@ -149,21 +436,201 @@ protected:
   bool loadCamera();
 
   /*!
-   * \brief reads target input files to create a calibration job
+   * \brief reads a calibration job file and appends its scenes to the job
+   * @param caljob_fn the calibration job file
+   * @param scene_id_offset added to every scene id of the file
    * @return true if successfully loaded caljob file
    */
-  bool loadCalJob();
+  bool loadCalJob(const std::string &caljob_fn, int scene_id_offset = 0);
+
+  /** @brief makes a camera known by its name to the calibration job files loaded later
+   *  @param camera the camera, it replaces a camera of the same name, so a moving camera shadows a static one
+   */
+  void defineCamera(const boost::shared_ptr<Camera> &camera);
+
+  /** @brief makes a target known by its name to the calibration job files loaded later
+   *  @param target the target, it replaces a target of the same name
+   */
+  void defineTarget(const boost::shared_ptr<Target> &target);
 
-  /** @brief runs the data collection portion of the job
+  /** @brief runs the data collection portion of the job, discarding all previously collected data
    * @return true if successful
    */
   bool runObservations();
 
+  /** @brief collects the scenes which have not been observed yet
+   * @return true if successful
+   */
+  bool observeNewScenes();
+
+  /** @brief enters a target in the target table, the observations of the target refer to it by its target_id
+   *  @param target the target, its target_id is set to its name id
+   */
+  void registerTarget(const boost::shared_ptr<Target> &target);
+
+  /** @brief tells if none of the cameras of a scene is still in use by the scenes in flight
+   *  @param scene the scene to acquire next
+   *  @param in_flight scenes acquired but not registered yet
+   */
+  bool camerasIdle(const ObservationScene &scene, const std::deque<SceneAcquisition*> &in_flight);
+
+  /** @brief configures and triggers the cameras of a scene and starts the detection of their observations
+   *  @param scene position of the scene in scene_list_
+   *  @param acquisition output, the triggered cameras, valid until checkAcquisition() returns
+   *  @return true if every camera was triggered
+   */
+  bool acquireScene(size_t scene, SceneAcquisition &acquisition);
+
+  /** @brief task of the detection workers, waits for the trigger of a camera and collects its observations
+   *  @param acquisition the scene being acquired
+   *  @param camera index of the camera in the acquisition
+   */
+  void detectCamera(SceneAcquisition *acquisition, size_t camera);
+
+  /** @brief loop of the detection workers started by observeNewScenes(), runs the cameras queued by
+   *         acquireScene() until stop_detection_ is set and the queue is empty
+   */
+  void detectionWorker();
+
+  /** @brief lets the detection workers finish the queued cameras and joins them, called by the destructor */
+  void stopDetectionWorkers();
+
+  /** @brief waits until the detection of every camera of an acquired scene is finished
+   *  @param acquisition the acquired scene, its timed out triggers are entered in pending_triggers_
+   *  @return true if every camera observed the scene
+   */
+  bool checkAcquisition(SceneAcquisition &acquisition);
+
+  /** @brief adds the blocks and stores the observations of an acquired scene
+   *  @param acquisition the acquired scene
+   *  @return true if successful
+   */
+  bool registerScene(SceneAcquisition &acquisition);
+
   /** @brief runs the optimization portion of the job
    * @return true if successful
    */
   bool runOptimization();
 
+  /** @brief sets the solver options shared by every solve of the job and attaches the solver monitor,
+   *         the legacy per scene solve uses these alone
+   *  @param options the options to configure
+   *  @param monitor_callback records the iterations of this solve in solver_monitor_, it must outlive the solve
+   */
+  void configureSolverOptions(ceres::Solver::Options &options, SolverMonitor::SolveCallback &monitor_callback);
+
+  /** @brief chooses the linear solver and threads for a problem built from a set of observations,
+   *         it only reads solver_planner_ so the component workers may call it concurrently
+   *  @param problem the built problem
+   *  @param observations rows of the observations in the problem
+   *  @param auto_tune time the candidate solvers on the problem, see setAutoTuneSolver()
+   *  @param max_threads most threads the solve may use
+   *  @param options the options to configure
+   *  @return true if the explicit Schur ordering was attached to the options
+   */
+  bool planSolverOptions(ceres::Problem &problem, const std::vector<int> &observations, bool auto_tune,
+                         int max_threads, ceres::Solver::Options &options);
+
+  /** @brief legacy optimization, solves the cumulative problem once per camera in every scene
+   * @return true if successful
+   */
+  bool runPerSceneOptimization();
+
+  /** @brief builds the problem once from every collected observation and solves it once
+   * @return true if successful
+   */
+  bool runSingleOptimization();
+
+  /** @brief partitions the observations into independent components and solves them on a thread pool
+   * @return true if successful
+   */
+  bool runComponentOptimization();
+
+  /** @brief groups observations connected through shared camera extrinsics or estimated target pose blocks,
+   *         the constant target poses do not connect them
+   *  @param components output, one entry per connected component
+   */
+  void partitionObservations(std::vector<ProblemComponent> &components);
+
+  /** @brief worker loop, builds and solves components until none remain
+   *  @param components all components of the job
+   *  @param next_component index of the next unclaimed component, guarded by component_mutex_
+   */
+  void solveComponents(std::vector<ProblemComponent> *components, size_t *next_component);
+
+  /** @brief solves the observations under a robust loss and removes the outliers, see setOutlierPruning()
+   *  @param observations rows of the observations, on return only the inliers remain
+   *  @param max_threads most threads the robust solve may use
+   *  @return number of observations removed
+   */
+  size_t pruneOutliers(std::vector<int> &observations, int max_threads);
+
+  /** @brief adds the residual blocks of a set of observations to a problem and holds the target poses constant,
+   *         apart from the estimated moving target poses, see setEstimateTargetPoses()
+   *  @param problem the problem receiving the residual blocks
+   *  @param observations rows of the observations, grouped into one block per view when use_batched_residuals_ is set
+   *  @param loss_scale scale of a Cauchy loss on every point, 0 for a squared loss
+   */
+  void addObservationResiduals(ceres::Problem &problem, const std::vector<int> &observations,
+                               double loss_scale = 0.0);
+
+  /** @brief creates the reprojection cost for one observation and adds it to the problem
+   *  @param problem the problem receiving the residual block
+   *  @param row row of the observation in observation_store_
+   *  @param loss_scale scale of a Cauchy loss, 0 for a squared loss
+   */
+  void addObservationResidual(ceres::Problem &problem, int row, double loss_scale = 0.0);
+
+  /** @brief true if the target pose of an observation is a moving target pose estimated by the solve,
+   *         see setEstimateTargetPoses(), the anchoring first pose of each target is included
+   *  @param row row of the observation in observation_store_
+   */
+  bool isEstimatedTargetPose(int row);
+
+  /** @brief records which problem estimated the extrinsics and target pose blocks of the observations
+   *  @param observations rows of the observations added to the problem
+   *  @param problem the problem
+   */
+  void mapBlocksToProblem(const std::vector<int> &observations, ceres::Problem *problem);
+
+  /** @brief the view an observation belongs to
+   *  @param row row of the observation in observation_store_
+   */
+  ViewKey viewKey(int row) const;
+
+  /** @brief fills extrinsics_ and target_pose_ with one entry per camera in each scene */
+  void extractResults();
+
+  /** @brief the observations collected so far, one row per point */
+  ObservationStore& getObservationStore()
+  {
+    return observation_store_;
+  }
+
+  /** @brief appends a scene built outside of the calibration job file to the scene list
+   *  @param scene the scene
+   */
+  void addScene(const ObservationScene &scene)
+  {
+    scene_list_.push_back(scene);
+  }
+
+  /** @brief number of timed out triggers which have not returned yet */
+  size_t numPendingTriggers() const
+  {
+    return pending_triggers_.size();
+  }
+
+  /** @brief the timed out trigger of a camera observer
+   *  @param observer the camera observer
+   *  @return the trigger, empty if the last trigger of the observer did not time out
+   */
+  boost::shared_ptr<TriggerCompletion> getPendingTrigger(CameraObserver *observer) const
+  {
+    std::map<CameraObserver*, boost::shared_ptr<TriggerCompletion> >::const_iterator it = pending_triggers_.find(observer);
+    return it == pending_triggers_.end() ? boost::shared_ptr<TriggerCompletion>() : it->second;
+  }
+
   /** @brief Adds a new camera
    *  @param camera_to_add camera to add
    *  @return true if successful
@@ -201,23 +668,62 @@ protected:
   bool appendNewScene(Trigger trig);
 
 private:
-  std::vector<ObservationDataPointList> observation_data_point_list_;
-  std::vector<ObservationScene> scene_list_; /*!< contains list of scenes which define the job */
   std::string camera_def_file_name_; /*!< this file describes all cameras in job */
   std::string target_def_file_name_; /*!< this file describes all targets in job */
   std::string caljob_def_file_name_; /*!< this file describes all observations in job */
   std::string reference_frame_; /*!< this the frame to which the camera is being calibrated (and to which the target is positioned) */
   std::vector<std::string> target_frames_; /*!< this the frame of the target points */
+  std::map<std::string, boost::shared_ptr<Camera> > defined_cameras_; /*!< cameras of the camera file by name, unlike
+                                                                           the blocks these survive every run */
+  std::map<std::string, boost::shared_ptr<Target> > defined_targets_; /*!< targets of the target file by name */
   std::vector<std::string> camera_optical_frames_; /*!< this the frame in which observations were made */
   std::vector<std::string> camera_intermediate_frames_; /*!< this the frame which links camera optical frame to reference frame */
   int current_scene_; /*!< id of current scene under review or construction */
   std::vector<ROSCameraObserver> camera_observers_; /*!< interface to images from cameras */
   std::vector<Target> defined_target_set_; /*!< TODO Not sure if I'll use this one */
   CeresBlocks ceres_blocks_; /*!< This structure maintains the parameter sets for ceres */
-  ceres::Problem problem_; /*!< This is the object which solves non-linear optimization problems */
+  boost::shared_ptr<ceres::Problem> problem_; /*!< This is the object which solves non-linear optimization problems */
   std::vector<P_BLOCK> extrinsics_; /*!< This is the parameter block which holds the optimized camera extrinsics solution */
-  std::vector<P_BLOCK> original_extrinsics_; /*!< This is the parameter block which holds the original camera extrinsics */
+  std::vector<std::vector<double> > original_extrinsics_; /*!< copies of the camera extrinsics as loaded, the
+                                                              parameter blocks do not outlive a run */
   std::vector<P_BLOCK> target_pose_; /*!< This is the parameter block which holds the optimized target pose solution */
+  OptimizationMode optimization_mode_; /*!< how runOptimization() builds and solves the problem */
+  int num_solves_; /*!< calls to ceres::Solve() in the last optimization */
+  double build_time_; /*!< seconds spent adding residual blocks in the last optimization */
+  double solve_time_; /*!< seconds spent in ceres::Solve() in the last optimization */
+  int num_threads_; /*!< worker threads used to solve independent components */
+  boost::mutex component_mutex_; /*!< guards the queue of components during a parallel solve */
+  std::vector<boost::shared_ptr<ceres::Problem> > component_problems_; /*!< problems solved by the ComponentSolve mode */
+  bool use_analytic_jacobians_; /*!< build the problem from analytic rather than automatic differentiation costs */
+  bool use_batched_residuals_; /*!< build one residual block per view of a target rather than per point */
+  size_t num_observed_scenes_; /*!< scenes at the front of scene_list_ whose observations are stored */
+  bool has_solution_; /*!< the parameter blocks hold the result of a successful optimization */
+  std::map<P_BLOCK, ceres::Problem*> block_problems_; /*!< the problem which estimated each pose block */
+  std::vector<std::vector<double> > extrinsics_covariance_; /*!< covariance of each extrinsics_ block */
+  std::vector<std::vector<double> > target_pose_covariance_; /*!< covariance of each target_pose_ block */
+  double covariance_time_; /*!< seconds spent in the last covariance computation */
+  bool prune_outliers_; /*!< remove outliers with a robust solve before the final solve */
+  double outlier_threshold_; /*!< reprojection error in pixels above which an observation is an outlier */
+  size_t num_pruned_; /*!< observations removed as outliers in the last optimization */
+  SolverMonitor solver_monitor_; /*!< records the iterations of every solve and enforces the time budget */
+  SolverPlanner solver_planner_; /*!< chooses the linear solver of each problem */
+  bool auto_tune_solver_; /*!< time the candidate linear solvers on the SingleSolve problem */
+  bool estimate_target_poses_; /*!< estimate the poses of the moving targets instead of holding them constant */
+  bool schur_ordered_; /*!< the last SingleSolve used the explicit Schur ordering */
+  ceres::LinearSolverType linear_solver_type_; /*!< linear solver of the last SingleSolve */
+  std::vector<boost::shared_ptr<Target> > target_table_; /*!< commanded targets by target_id, empty for other ids */
+  std::vector<int> observation_rows_; /*!< rows of the SingleSolve problem */
+  double camera_timeout_; /*!< seconds a scene waits for its triggered cameras */
+  size_t pipeline_depth_; /*!< scenes in flight between acquisition and registration */
+  std::vector<boost::shared_ptr<SceneAcquisition> > scene_acquisitions_; /*!< one for each scene in flight, reused */
+  boost::mutex detection_mutex_; /*!< guards detection_queue_ and stop_detection_ */
+  boost::condition_variable detection_queued_; /*!< signals the detection workers that a camera was queued */
+  std::deque<std::pair<SceneAcquisition*, size_t> > detection_queue_; /*!< triggered cameras awaiting detection */
+  bool stop_detection_; /*!< the detection workers return once the queue is empty */
+  boost::thread_group detection_workers_; /*!< started by the first run which needs them, kept for the later runs */
+  ObservationStore observation_store_; /*!< every observation collected by runObservations(), one row per point */
+  std::vector<ObservationScene> scene_list_; /*!< contains list of scenes which define the job */
+  std::map<CameraObserver*, boost::shared_ptr<TriggerCompletion> > pending_triggers_; /*!< timed out triggers not yet returned */
 
 };//end class
 
@@ -52,11 +52,12 @@ public:
    static cameras get but one set of pose parameters
    */
   bool isMoving();
-  boost::shared_ptr<ROSCameraObserver> camera_observer_;/*!< processes images, does CameraObservations */
+  boost::shared_ptr<CameraObserver> camera_observer_;/*!< processes images, does CameraObservations, a ROSCameraObserver when loaded from file */
   CameraParameters camera_parameters_;/*!< The intrinsic and extrinsic parameters */
   //    ::std::ostream& operator<<(::std::ostream& os, const Camera& C){ return os<< "TODO";};
 
   std::string camera_name_; /*!< string camera_name_ unique name of a camera */
+  int camera_id_; /*!< id of camera_name_ in the job's name table, -1 until the camera is added to CeresBlocks */
 
   bool fixed_intrinsics_; /** are the extrinsics known? */
   bool fixed_extrinsics_; /** are the extrinsics known? */
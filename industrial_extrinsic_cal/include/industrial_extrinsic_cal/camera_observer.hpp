@@ -20,18 +20,154 @@
 #define CAMERA_OBSERVER_HPP_
 
 #include <industrial_extrinsic_cal/basic_types.h> /* Target,Roi,Observation,CameraObservations */
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
 
 namespace industrial_extrinsic_cal
 {
 
+/** @brief read only view of a contiguous range of observations, it does not own them
+ *         and is only valid until the viewed CameraObservations change */
+class ObservationSpan
+{
+public:
+  /** @brief views every observation held by camera_observations */
+  explicit ObservationSpan(const CameraObservations &camera_observations) :
+      begin_(camera_observations.observations.empty() ? NULL : &camera_observations.observations[0]),
+      end_(begin_ + camera_observations.observations.size())
+  {
+  }
+
+  /** @brief views the observations from begin up to, not including, end */
+  ObservationSpan(const Observation *begin, const Observation *end) :
+      begin_(begin), end_(end)
+  {
+  }
+
+  const Observation* begin() const
+  {
+    return begin_;
+  }
+
+  const Observation* end() const
+  {
+    return end_;
+  }
+
+  size_t size() const
+  {
+    return end_ - begin_;
+  }
+
+  bool empty() const
+  {
+    return begin_ == end_;
+  }
+
+  const Observation& operator[](size_t i) const
+  {
+    return begin_[i];
+  }
+
+private:
+  const Observation *begin_;
+  const Observation *end_;
+};
+
+/*! \brief outcome of a camera trigger */
+namespace trigger_results
+{
+enum trigger_results_
+{
+  Pending, /*!< the camera has not finished its observations */
+  Done, /*!< the observations are ready */
+  Failed, /*!< the camera finished without observations, e.g. no image could be converted */
+  TimedOut /*!< returned by TriggerCompletion::wait() when the deadline passed while still pending */
+};
+}
+typedef trigger_results::trigger_results_ TriggerResult;
+
+/** @brief completion handle of one camera trigger, completed once by the triggering thread
+ *         while any number of threads block on it without spinning */
+class TriggerCompletion : boost::noncopyable
+{
+public:
+  TriggerCompletion() :
+      result_(trigger_results::Pending)
+  {
+  }
+
+  /** @brief records the result and wakes the waiters, only the first call has any effect */
+  /** @param success true if the observations are ready */
+  void complete(bool success)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (result_ != trigger_results::Pending)
+    {
+      return;
+    }
+    result_ = success ? trigger_results::Done : trigger_results::Failed;
+    completed_.notify_all();
+  }
+
+  /** @brief blocks until the trigger completes */
+  /** @return Done or Failed */
+  TriggerResult wait()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (result_ == trigger_results::Pending)
+    {
+      completed_.wait(lock);
+    }
+    return result_;
+  }
+
+  /** @brief blocks until the trigger completes or the deadline passes */
+  /** @param deadline absolute time after which the wait gives up */
+  /** @return Done or Failed, TimedOut if the trigger was still pending at the deadline */
+  TriggerResult wait(const boost::system_time &deadline)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (result_ == trigger_results::Pending)
+    {
+      if (!completed_.timed_wait(lock, deadline) && result_ == trigger_results::Pending)
+      {
+        return trigger_results::TimedOut;
+      }
+    }
+    return result_;
+  }
+
+  /** @brief current result without blocking, Pending until complete() is called */
+  TriggerResult result() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return result_;
+  }
+
+private:
+  mutable boost::mutex mutex_;
+  boost::condition_variable completed_;
+  TriggerResult result_;
+};
+
 class CameraObserver
 {
 public:
-  /** @brief Default destructor */
+  /** @brief constructor, triggers wait for their image without a time limit */
+  CameraObserver() :
+      trigger_timeout_(0.0)
+  {
+  }
+
+  /** @brief destructor, waits for the last trigger to return */
+  /** observers whose triggerCamera() uses their own members call joinTrigger() in their own destructor */
   virtual ~CameraObserver()
   {
+    joinTrigger();
   }
-  ;
 
   /** @brief add a target to look for */
   /** @param targ a target to look for */
@@ -48,16 +184,72 @@ public:
   /** @param output all observations of targets defined */
   virtual int getObservations(CameraObservations &camera_observations)=0;
 
+  /** @brief return observations by exchanging buffers with the caller rather than copying them */
+  /** @param camera_observations output all observations of targets defined, its previous buffer goes to the observer for reuse */
+  /** the default copies through getObservations() */
+  virtual int swapObservations(CameraObservations &camera_observations)
+  {
+    return getObservations(camera_observations);
+  }
+
   /** @brief print this object TODO */
   virtual void triggerCamera()=0;
 
   /** @brief tells when camera has completed its observations */
   virtual bool observationsDone()=0;
 
+  /** @brief triggers the camera without blocking the caller */
+  /** the default runs triggerCamera() on a thread owned by the observer and completes the handle with
+   *  observationsDone(), a trigger which has not returned yet leaves the handle pending */
+  /** @return handle completed once the observations are ready or have failed */
+  virtual boost::shared_ptr<TriggerCompletion> triggerCameraAsync()
+  {
+    boost::shared_ptr<TriggerCompletion> completion = boost::make_shared<TriggerCompletion>();
+    joinTrigger();
+    trigger_thread_ = boost::thread(boost::bind(&CameraObserver::runTrigger, this, completion));
+    return completion;
+  }
+
+  /** @brief limits how long a trigger waits for its image */
+  /** @param seconds the limit, 0 waits indefinitely */
+  void setTriggerTimeout(double seconds)
+  {
+    trigger_timeout_ = seconds;
+  }
+
   std::string camera_name_; /*!< string camera_name_ unique name of a camera */
 
   /** @brief print this object TODO */
   //    virtual ::std::ostream& operator<<(::std::ostream& os, const CameraObserver& camera);
+
+protected:
+  /** @brief waits until the thread started by the last triggerCameraAsync() has returned */
+  void joinTrigger()
+  {
+    if (trigger_thread_.joinable())
+    {
+      trigger_thread_.join();
+    }
+  }
+
+  /** @brief body of the thread started by triggerCameraAsync() */
+  void runTrigger(boost::shared_ptr<TriggerCompletion> completion)
+  {
+    try
+    {
+      triggerCamera();
+      completion->complete(observationsDone());
+    }
+    catch (...)
+    {
+      completion->complete(false);
+    }
+  }
+
+  double trigger_timeout_; /*!< seconds a trigger waits for its image, 0 for no limit */
+
+private:
+  boost::thread trigger_thread_; /*!< thread of the last triggerCameraAsync(), joined before the next one */
 };
 
 } // end of namespace
@@ -22,11 +22,64 @@
 #include <ros/console.h>
 #include <industrial_extrinsic_cal/basic_types.h>
 #include <industrial_extrinsic_cal/camera_definition.h>
+#include <industrial_extrinsic_cal/name_table.h>
+#include <industrial_extrinsic_cal/parameter_arena.h>
+#include <industrial_extrinsic_cal/scene_registry.h>
 #include "boost/make_shared.hpp"
+#include <boost/unordered_map.hpp>
+#include "ceres/ceres.h"
+#include <set>
 
 namespace industrial_extrinsic_cal
 {
 
+/*! \brief elimination groups of the Schur ordering, lower groups are eliminated first */
+namespace schur_groups
+{
+enum schur_groups_
+{
+  Points = 0, /*!< target point positions, the most numerous and smallest blocks */
+  TargetPoses = 1, /*!< target poses */
+  Extrinsics = 2, /*!< camera extrinsics, kept in the reduced camera system */
+  Intrinsics = 3 /*!< camera intrinsics, kept in the reduced camera system */
+};
+}
+typedef schur_groups::schur_groups_ SchurGroup;
+
+/*! \brief a camera and the arena blocks holding its parameters */
+typedef struct
+{
+  boost::shared_ptr<Camera> cam;
+  P_BLOCK extrinsics; /*!< 6 doubles, followed directly by the intrinsics */
+  P_BLOCK intrinsics; /*!< 9 doubles */
+} CameraBlocks;
+
+/*! \brief a moving camera's shared intrinsics, its extrinsics are kept separately for each scene */
+typedef struct
+{
+  boost::shared_ptr<Camera> cam;
+  P_BLOCK intrinsics; /*!< 9 doubles, used in every scene */
+  std::vector<P_BLOCK> extrinsics; /*!< 6 doubles for each scene by scene index, NULL where the camera is absent */
+  P_BLOCK last_extrinsics; /*!< 6 doubles of the most recently added scene */
+} MovingCameraBlocks;
+
+/*! \brief a target and the arena blocks holding its parameters */
+typedef struct
+{
+  boost::shared_ptr<Target> targ;
+  P_BLOCK pose; /*!< 6 doubles */
+  P_BLOCK points; /*!< 3 doubles for each of the target's points */
+} TargetBlocks;
+
+/*! \brief a moving target's point table, shared by every scene, its poses are kept separately for each scene */
+typedef struct
+{
+  boost::shared_ptr<Target> targ;
+  P_BLOCK points; /*!< 3 doubles for each of the target's points, never adjusted */
+  std::vector<P_BLOCK> poses; /*!< 6 doubles for each scene by scene index, NULL where the target is absent */
+  P_BLOCK last_pose; /*!< 6 doubles of the most recently added scene */
+} MovingTargetBlocks;
+
 /** \brief These blocks of data hold the ceres parameters upon which the optimizaition proceeds
  *   Static cameras have a block of parameters for their 6Dof Pose
  *                  they have a block of 4 parameters for pinhole projection model intrinsics
@@ -41,9 +94,34 @@ public:
   /** \brief Destructor */
   ~CeresBlocks();
 
-  /*! \brief clear all static and moving cameras and targets */
+  /*! \brief clear all static and moving cameras and targets, the name table and the scene registry are kept
+   *   so ids and scene indexes stay valid
+   *   values which were not stored with storeParameters() are dropped, e.g. those of a failed solve */
   void clearCamerasTargets();
 
+  /*! \brief copies the current parameter block values back into the Camera and Target objects
+   *   the blocks live in an arena, so the objects only see the optimized values after this is called */
+  void storeParameters();
+
+  /*! \brief id of a camera or target name, the name is interned if it has not been seen yet
+   *  \param name camera or target name
+   *  \return id used by the id based lookups below
+   */
+  int getNameId(const std::string &name);
+
+  /*! \brief the job wide table of camera and target names */
+  const NameTable& getNameTable() const;
+
+  /*! \brief dense index of a scene id, the scene is registered if it has not been seen yet
+   *   like the name ids, the indexes stay valid when the cameras and targets are cleared
+   *  \param scene_id scene id from the calibration job
+   *  \return index of the scene
+   */
+  int getSceneIndex(int scene_id);
+
+  /*! \brief the job wide registry of scene ids */
+  const SceneRegistry& getSceneRegistry() const;
+
   /*! \brief adds a static camera to job's list of cameras
    *  \param camera_to_add this is the camera added to the list
    *  \return true on success
@@ -57,13 +135,16 @@ public:
   bool addStaticTarget(boost::shared_ptr<Target> target_to_add);
 
   /*! \brief adds a moving camera to job's list of cameras
+   *   the first scene of a camera allocates its intrinsics, every scene adds only 6 extrinsic parameters
    *  \param camera_to_add this is the camera added to the list
    *  \param scene_id the scene's id, only one camera of given name exist in each scene
    *  \return true on success
    */
   bool addMovingCamera(boost::shared_ptr<Camera> camera_to_add, int scene_id);
 
-  /*! \brief adds a static target to job's list of static targets
+  /*! \brief adds a moving target to job's list of targets
+   *   the first scene of a target copies its points into a table shared by all of its scenes,
+   *   every scene adds only its own 6 pose parameters
    *  \param target_to_add this is the target added to the list
    *  \param scene_id the scene's id, only one target of given name exist in each scene
    *  \return true on success
@@ -85,74 +166,98 @@ public:
    */
   const boost::shared_ptr<Target>  getTargetByName(const std::string &target_name);
 
-  P_BLOCK getStaticCameraParameterBlockIntrinsics(std::string camera_name);
+  P_BLOCK getStaticCameraParameterBlockIntrinsics(const std::string &camera_name);
 
   /*! @brief gets a pointer to the intrinsic parameters of a moving camera
    *  @param camera_name the camera's name
-   *  @return pointer to the intrinsic parameters for this camera, note that
-   *          a number of copies of the intrinsics exist, because the camera
-   *          was duplicated in each scene it made an observation
-   *          however, the first scene in which the camera was used contains the
-   *          only set of intrinsics to be adjusted, and therefore is the only one returned
+   *  @return pointer to the intrinsic parameters for this camera, a single set
+   *          is shared by every scene in which the camera made an observation
    */
-  P_BLOCK getMovingCameraParameterBlockIntrinsics(std::string camera_name);
+  P_BLOCK getMovingCameraParameterBlockIntrinsics(const std::string &camera_name);
 
   /*! @brief gets a pointer to the extrinsics parameters of a static camera
    *  @param camera_name the camera's name
    *  @return pointer to the only existing set of extrinsics for this camera
    */
-  P_BLOCK getStaticCameraParameterBlockExtrinsics(std::string camera_name);
+  P_BLOCK getStaticCameraParameterBlockExtrinsics(const std::string &camera_name);
 
   /*! @brief gets a pointer to the extrisic parameters of a moving camera
    *  @param camera_name the camera's name
-   *  @return pointer to the intrinsic parameters for this camera, note that
-   *          a number of copies of the intrinsics exist, because the camera
-   *          was duplicated in each scene it made an observation.
-   *          Therefore, the extrinsic parameters must be the ones from
-   *          the correct scene.
+   *  @param scene_id id of scene where the camera made the observation
+   *  @return pointer to the extrinsic parameters for this camera in the given scene,
+   *          each scene in which the camera made an observation has its own set
    */
-  P_BLOCK getMovingCameraParameterBlockExtrinsics(std::string camera_name, int scene_id);
+  P_BLOCK getMovingCameraParameterBlockExtrinsics(const std::string &camera_name, int scene_id);
 
   /*! @brief gets a pointer to the pose parameters of a static target
    *  @param target_name the target's name
    *  @return pointer to the only existing set of pose parameters for this target
    */
-  P_BLOCK getStaticTargetPoseParameterBlock(std::string target_name);
+  P_BLOCK getStaticTargetPoseParameterBlock(const std::string &target_name);
 
   /*! @brief gets a pointer to the position parameters of a static target's point
    *  @param target_name the target's name
    *  @param point_id id of point on target
    *  @return pointer to the only existing set of position parameters for this point
    */
-  P_BLOCK getStaticTargetPointParameterBlock(std::string target_name, int point_id);
+  P_BLOCK getStaticTargetPointParameterBlock(const std::string &target_name, int point_id);
 
   /*! @brief gets a pointer to the targets pose parameters
    *  @param target_name moving target's name
    *  @param point_id id of point on target
    *  @param scene_id id of scene where target was imaged
-   *  @return pointer to the pose parameters of the target
-   *          a number of copies of the pose parameters might exist for a moving target
-   *          because the target was duplicated in each scene it was observed.
-   *          Therefore, the desired set is the only copy with the given scene_id
+   *  @return pointer to the pose parameters of the target in the given scene,
+   *          each scene in which the target was observed has its own set
    */
-  P_BLOCK getMovingTargetPoseParameterBlock(std::string target_name, int scene_id);
+  P_BLOCK getMovingTargetPoseParameterBlock(const std::string &target_name, int scene_id);
 
   /*! @brief gets a pointer to the point's position parameters
    *  @param target_name moving target's name
    *  @param point_id id of point on target
    *  @return pointer to the position parameters of the point
-   *          a number of copies of the point parameters might exist
-   *          because the target was duplicated in each scene it was observed.
-   *          However, the coordinates of the point in the target frame should not change
-   *          Therefore, only the first occurance (first scene) is used
+   *          the coordinates of the point in the target frame do not change,
+   *          so a single table copied from the first scene is shared by every scene
    */
-  P_BLOCK getMovingTargetPointParameterBlock(std::string target_name, int pnt_id);
+  P_BLOCK getMovingTargetPointParameterBlock(const std::string &target_name, int pnt_id);
+
+  /*! @brief orders the blocks of a problem for a Schur solver: points, then target poses, then camera extrinsics,
+   *         then camera intrinsics. Empty groups are skipped, so the first group holding a block is eliminated.
+   *  @param problem_blocks every parameter block in the problem, ceres requires the ordering to hold exactly these
+   *  @param ordering output, the blocks of problem_blocks found among the cameras and targets
+   *  @return number of blocks ordered, the ordering is only valid if this equals problem_blocks.size()
+   */
+  int buildSchurOrdering(const std::set<P_BLOCK> &problem_blocks, ceres::ParameterBlockOrdering &ordering);
+
+  /*! @brief id based versions of the lookups above, the ids come from getNameId()
+   *         these avoid hashing the name on every observation
+   */
+  P_BLOCK getStaticCameraParameterBlockIntrinsics(int camera_id);
+  P_BLOCK getMovingCameraParameterBlockIntrinsics(int camera_id);
+  P_BLOCK getStaticCameraParameterBlockExtrinsics(int camera_id);
+  P_BLOCK getMovingCameraParameterBlockExtrinsics(int camera_id, int scene_id);
+  P_BLOCK getStaticTargetPoseParameterBlock(int target_id);
+  P_BLOCK getStaticTargetPointParameterBlock(int target_id, int point_id);
+  P_BLOCK getMovingTargetPoseParameterBlock(int target_id, int scene_id);
+  P_BLOCK getMovingTargetPointParameterBlock(int target_id, int pnt_id);
 
   //private:
   std::vector<boost::shared_ptr<Camera> > static_cameras_; /*!< all non-moving cameras in job */
-  std::vector<boost::shared_ptr<MovingCamera> > moving_cameras_; /*! only one camera of a given name per scene */
   std::vector<boost::shared_ptr<Target> > static_targets_; /*!< all non-moving targets in job */
-  std::vector<boost::shared_ptr<MovingTarget> > moving_targets_; /*! only one target of a given name per scene */
+
+private:
+  /*! \brief allocates arena blocks for a camera, initialized from its parameters */
+  CameraBlocks allocateCameraBlocks(boost::shared_ptr<Camera> camera);
+  /*! \brief allocates an arena block holding the points of a target */
+  P_BLOCK allocatePoints(const Target &target);
+
+  // the indexes below are maintained by the add and clear methods, the vectors above keep the insertion order
+  NameTable names_; /*!< camera and target names, the indexes are keyed by their ids */
+  SceneRegistry scenes_; /*!< scene ids, the per scene blocks are kept by their index */
+  ParameterArena arena_; /*!< owns every parameter block handed to ceres */
+  boost::unordered_map<int, CameraBlocks> static_camera_index_; /*!< static cameras by name id */
+  boost::unordered_map<int, MovingCameraBlocks> moving_camera_index_; /*!< moving cameras by name id */
+  boost::unordered_map<int, TargetBlocks> static_target_index_; /*!< static targets by name id */
+  boost::unordered_map<int, MovingTargetBlocks> moving_target_index_; /*!< moving targets by name id */
 };//end class
 
 }// end namespace industrial_extrinsic_cal
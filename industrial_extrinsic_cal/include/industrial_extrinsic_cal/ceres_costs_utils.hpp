@@ -22,6 +22,8 @@
 #include "ceres/ceres.h"
 #include "ceres/rotation.h"
 #include <industrial_extrinsic_cal/basic_types.h>
+#include <algorithm>
+#include <limits>
 
 namespace industrial_extrinsic_cal
 {
@@ -126,6 +128,74 @@ namespace industrial_extrinsic_cal
     double pnt_z_;/*!< known location of point in target's reference frame z */
   };
 
+  /** @brief TargetCameraReprjErrorNoDistortion with the target pose applied, the point is moved from the target
+   *         frame into the world frame before the camera sees it, so the target pose has a jacobian.
+   *         The target pose block is x, y, z, ax, ay, az as in Pose6d
+   */
+  struct TargetPoseCameraReprjErrorNoDistortion
+  {
+    TargetPoseCameraReprjErrorNoDistortion(double ob_x, double ob_y, double fx, double fy, double cx, double cy,
+                                           double pnt_x, double pnt_y, double pnt_z) :
+        ox_(ob_x), oy_(ob_y), fx_(fx), fy_(fy), cx_(cx), cy_(cy), pnt_x_(pnt_x), pnt_y_(pnt_y), pnt_z_(pnt_z)
+    {
+    }
+
+    template<typename T>
+      bool operator()(const T* const c_p1, /** extrinsic parameters */
+                      const T* const t_p1, /** 6Dof transform of target points into world frame */
+                      T* resid) const
+      {
+        /** rotate and translate the point into the world frame */
+        T point[3];
+        point[0] = T(pnt_x_);
+        point[1] = T(pnt_y_);
+        point[2] = T(pnt_z_);
+        T world_point[3];
+        ceres::AngleAxisRotatePoint(t_p1 + 3, point, world_point);
+        world_point[0] += t_p1[0];
+        world_point[1] += t_p1[1];
+        world_point[2] += t_p1[2];
+
+        /** rotate and translate the world point into the camera frame */
+        T p[3];
+        ceres::AngleAxisRotatePoint(c_p1, world_point, p);
+        T xp1 = p[0] + c_p1[3];
+        T yp1 = p[1] + c_p1[4];
+        T zp1 = p[2] + c_p1[5];
+
+        /** scale into the image plane by distance away from camera */
+        T xp = xp1 / zp1;
+        T yp = yp1 / zp1;
+
+        /** perform projection using focal length and camera center into image plane */
+        resid[0] = T(fx_) * xp + T(cx_) - T(ox_);
+        resid[1] = T(fy_) * yp + T(cy_) - T(oy_);
+
+        return true;
+      } /** end of operator() */
+
+    /** Factory to hide the construction of the CostFunction object from */
+    /** the client code. */
+    static ceres::CostFunction* Create(const double o_x, const double o_y,
+                                       const double fx, const double fy,
+                                       const double cx, const double cy,
+                                       const double pnt_x, const double pnt_y,
+                                       const double pnt_z)
+    {
+      return (new ceres::AutoDiffCostFunction<TargetPoseCameraReprjErrorNoDistortion, 2, 6, 6>(
+          new TargetPoseCameraReprjErrorNoDistortion(o_x, o_y, fx, fy, cx, cy, pnt_x, pnt_y, pnt_z)));
+    }
+    double ox_; /** observed x location of object in image */
+    double oy_; /** observed y location of object in image */
+    double fx_; /*!< known focal length of camera in x */
+    double fy_; /*!< known focal length of camera in y */
+    double cx_; /*!< known optical center of camera in x */
+    double cy_; /*!< known optical center of camera in y */
+    double pnt_x_;/*!< known location of point in target's reference frame x */
+    double pnt_y_;/*!< known location of point in target's reference frame y */
+    double pnt_z_;/*!< known location of point in target's reference frame z */
+  };
+
   struct CameraReprjErrorNoDistortion
   {
     CameraReprjErrorNoDistortion(double ob_x, double ob_y, double fx, double fy, double cx, double cy) :
@@ -271,5 +341,564 @@ namespace industrial_extrinsic_cal
   };
 
 
+  /** @brief rotates a point by an angle axis vector, optionally computing the derivative
+   *         of the rotated point with respect to the angle axis vector
+   *  @param aa angle axis rotation
+   *  @param point point to rotate
+   *  @param rotated output, the rotated point
+   *  @param jacobian output, row major 3x3 d(rotated)/d(aa), may be NULL
+   */
+  inline void angleAxisRotatePointWithJacobian(const double aa[3], const double point[3], double rotated[3],
+                                               double jacobian[9])
+  {
+    const double theta2 = aa[0] * aa[0] + aa[1] * aa[1] + aa[2] * aa[2];
+    if (theta2 <= std::numeric_limits<double>::epsilon())
+    {
+      /** near zero use the same first order approximation as ceres, rotated = point + aa x point */
+      rotated[0] = point[0] + aa[1] * point[2] - aa[2] * point[1];
+      rotated[1] = point[1] + aa[2] * point[0] - aa[0] * point[2];
+      rotated[2] = point[2] + aa[0] * point[1] - aa[1] * point[0];
+      if (jacobian != NULL)
+      {
+        /** d(aa x point)/d(aa) = -[point]x */
+        jacobian[0] = 0.0;       jacobian[1] = point[2];  jacobian[2] = -point[1];
+        jacobian[3] = -point[2]; jacobian[4] = 0.0;       jacobian[5] = point[0];
+        jacobian[6] = point[1];  jacobian[7] = -point[0]; jacobian[8] = 0.0;
+      }
+      return;
+    }
+
+    double R[9]; /** column major, as returned by ceres */
+    ceres::AngleAxisToRotationMatrix(aa, R);
+    rotated[0] = R[0] * point[0] + R[3] * point[1] + R[6] * point[2];
+    rotated[1] = R[1] * point[0] + R[4] * point[1] + R[7] * point[2];
+    rotated[2] = R[2] * point[0] + R[5] * point[1] + R[8] * point[2];
+    if (jacobian == NULL)
+    {
+      return;
+    }
+
+    /** d(R*p)/d(aa) = -R [p]x (aa aa^T + (R^T - I)[aa]x) / theta^2   (Gallego and Yezzi) */
+    double A[9]; /** row major aa aa^T + (R^T - I)[aa]x */
+    const double W[9] = { 0.0, -aa[2], aa[1],
+                          aa[2], 0.0, -aa[0],
+                          -aa[1], aa[0], 0.0 }; /** row major [aa]x */
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        /** row r of R^T - I is column r of R minus the identity row */
+        double sum = 0.0;
+        for (int k = 0; k < 3; k++)
+        {
+          sum += (R[3 * r + k] - (r == k ? 1.0 : 0.0)) * W[3 * k + c];
+        }
+        A[3 * r + c] = aa[r] * aa[c] + sum;
+      }
+    }
+    double RP[9]; /** row major -R [p]x */
+    const double P[9] = { 0.0, -point[2], point[1],
+                          point[2], 0.0, -point[0],
+                          -point[1], point[0], 0.0 };
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        RP[3 * r + c] = -(R[r] * P[c] + R[r + 3] * P[3 + c] + R[r + 6] * P[6 + c]);
+      }
+    }
+    for (int r = 0; r < 3; r++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        jacobian[3 * r + c] = (RP[3 * r] * A[c] + RP[3 * r + 1] * A[3 + c] + RP[3 * r + 2] * A[6 + c]) / theta2;
+      }
+    }
+  }
+
+  /** @brief computes the rotated and translated point in the camera frame, and the derivatives of
+   *         that point with respect to the camera extrinsics and the untransformed point
+   *  @param c_p1 camera extrinsics, angle axis then translation
+   *  @param point the point to transform
+   *  @param camera_point output, point in camera frame
+   *  @param d_extrinsics output, row major 3x6 d(camera_point)/d(c_p1), may be NULL
+   *  @param d_point output, row major 3x3 d(camera_point)/d(point), this is R, may be NULL
+   */
+  inline void transformPointWithJacobian(const double c_p1[6], const double point[3], double camera_point[3],
+                                         double d_extrinsics[18], double d_point[9])
+  {
+    double d_aa[9];
+    angleAxisRotatePointWithJacobian(c_p1, point, camera_point, d_extrinsics == NULL ? NULL : d_aa);
+    camera_point[0] += c_p1[3];
+    camera_point[1] += c_p1[4];
+    camera_point[2] += c_p1[5];
+    if (d_extrinsics != NULL)
+    {
+      for (int r = 0; r < 3; r++)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          d_extrinsics[6 * r + c] = d_aa[3 * r + c];
+          d_extrinsics[6 * r + 3 + c] = (r == c ? 1.0 : 0.0);
+        }
+      }
+    }
+    if (d_point != NULL)
+    {
+      double R[9];
+      ceres::AngleAxisToRotationMatrix(c_p1, R);
+      for (int r = 0; r < 3; r++)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          d_point[3 * r + c] = R[3 * c + r];
+        }
+      }
+    }
+  }
+
+  /** @brief multiplies a row major 2x3 matrix by a row major 3xN matrix
+   *  @param A the 2x3 matrix
+   *  @param B the 3xN matrix
+   *  @param n number of columns in B
+   *  @param C output, the row major 2xN product
+   */
+  inline void multiply2x3By3xN(const double A[6], const double* B, int n, double* C)
+  {
+    for (int r = 0; r < 2; r++)
+    {
+      for (int c = 0; c < n; c++)
+      {
+        C[n * r + c] = A[3 * r] * B[c] + A[3 * r + 1] * B[n + c] + A[3 * r + 2] * B[2 * n + c];
+      }
+    }
+  }
+
+  /** @brief analytic jacobian version of TargetCameraReprjErrorNoDistortion, same residual and parameters.
+   *         The points are used in the target frame, so the target pose jacobian is zero, as it is for
+   *         the automatic differentiation version
+   */
+  class TargetCameraReprjErrorNoDistortionAnalytic : public ceres::SizedCostFunction<2, 6, 6>
+  {
+  public:
+    TargetCameraReprjErrorNoDistortionAnalytic(double ob_x, double ob_y,
+                                               double fx, double fy,
+                                               double cx, double cy,
+                                               double pnt_x, double pnt_y, double pnt_z)
+      : ox_(ob_x), oy_(ob_y), fx_(fx), fy_(fy), cx_(cx), cy_(cy)
+    {
+      point_[0] = pnt_x;
+      point_[1] = pnt_y;
+      point_[2] = pnt_z;
+    }
+
+    virtual bool Evaluate(double const* const* parameters, double* resid, double** jacobians) const
+    {
+      const double* c_p1 = parameters[0]; /** extrinsic parameters */
+      bool need_extrinsics = (jacobians != NULL && jacobians[0] != NULL);
+
+      double p[3]; /** point in camera frame */
+      double d_p_d_ext[18];
+      transformPointWithJacobian(c_p1, point_, p, need_extrinsics ? d_p_d_ext : NULL, NULL);
+
+      /** scale into the image plane by distance away from camera */
+      const double iz = 1.0 / p[2];
+      const double xp = p[0] * iz;
+      const double yp = p[1] * iz;
+
+      /** perform projection using focal length and camera center into image plane */
+      resid[0] = fx_ * xp + cx_ - ox_;
+      resid[1] = fy_ * yp + cy_ - oy_;
+
+      if (jacobians == NULL)
+      {
+        return true;
+      }
+      if (need_extrinsics)
+      {
+        const double d_r_d_p[6] = { fx_ * iz, 0.0, -fx_ * xp * iz,
+                                    0.0, fy_ * iz, -fy_ * yp * iz };
+        multiply2x3By3xN(d_r_d_p, d_p_d_ext, 6, jacobians[0]);
+      }
+      if (jacobians[1] != NULL)
+      {
+        std::fill(jacobians[1], jacobians[1] + 12, 0.0);
+      }
+      return true;
+    }
+
+    /** Factory to hide the construction of the CostFunction object from */
+    /** the client code. */
+    static ceres::CostFunction* Create(const double o_x, const double o_y,
+                                       const double fx, const double fy,
+                                       const double cx, const double cy,
+                                       const double pnt_x, const double pnt_y,
+                                       const double pnt_z)
+    {
+      return (new TargetCameraReprjErrorNoDistortionAnalytic(o_x, o_y, fx, fy, cx, cy, pnt_x, pnt_y, pnt_z));
+    }
+    double ox_; /** observed x location of object in image */
+    double oy_; /** observed y location of object in image */
+    double fx_; /*!< known focal length of camera in x */
+    double fy_; /*!< known focal length of camera in y */
+    double cx_; /*!< known optical center of camera in x */
+    double cy_; /*!< known optical center of camera in y */
+    double point_[3]; /*!< known location of point in target's reference frame */
+  };
+
+  /** @brief analytic jacobian version of CameraReprjErrorNoDistortion, same residual and parameters.
+   *         The known focal lengths and center are used, so the intrinsics jacobian is zero
+   */
+  class CameraReprjErrorNoDistortionAnalytic : public ceres::SizedCostFunction<2, 6, 9, 3>
+  {
+  public:
+    CameraReprjErrorNoDistortionAnalytic(double ob_x, double ob_y, double fx, double fy, double cx, double cy) :
+        ox_(ob_x), oy_(ob_y), fx_(fx), fy_(fy), cx_(cx), cy_(cy)
+    {
+    }
+
+    virtual bool Evaluate(double const* const* parameters, double* resid, double** jacobians) const
+    {
+      const double* c_p1 = parameters[0]; /** extrinsic parameters */
+      const double* point = parameters[2]; /** point being projected */
+      bool need_extrinsics = (jacobians != NULL && jacobians[0] != NULL);
+      bool need_point = (jacobians != NULL && jacobians[2] != NULL);
+
+      double p[3]; /** point in camera frame */
+      double d_p_d_ext[18];
+      double d_p_d_pnt[9];
+      transformPointWithJacobian(c_p1, point, p, need_extrinsics ? d_p_d_ext : NULL, need_point ? d_p_d_pnt : NULL);
+
+      /** scale into the image plane by distance away from camera */
+      const double iz = 1.0 / p[2];
+      const double xp = p[0] * iz;
+      const double yp = p[1] * iz;
+
+      /** perform projection using focal length and camera center into image plane */
+      resid[0] = fx_ * xp + cx_ - ox_;
+      resid[1] = fy_ * yp + cy_ - oy_;
+
+      if (jacobians == NULL)
+      {
+        return true;
+      }
+      const double d_r_d_p[6] = { fx_ * iz, 0.0, -fx_ * xp * iz,
+                                  0.0, fy_ * iz, -fy_ * yp * iz };
+      if (need_extrinsics)
+      {
+        multiply2x3By3xN(d_r_d_p, d_p_d_ext, 6, jacobians[0]);
+      }
+      if (jacobians[1] != NULL)
+      {
+        std::fill(jacobians[1], jacobians[1] + 18, 0.0);
+      }
+      if (need_point)
+      {
+        multiply2x3By3xN(d_r_d_p, d_p_d_pnt, 3, jacobians[2]);
+      }
+      return true;
+    }
+
+    /** Factory to hide the construction of the CostFunction object from */
+    /** the client code. */
+    static ceres::CostFunction* Create(const double o_x, const double o_y, const double f_x, const double f_y, const double c_x, const double c_y)
+    {
+      return (new CameraReprjErrorNoDistortionAnalytic(o_x, o_y, f_x, f_y, c_x, c_y));
+    }
+    double ox_; /** observed x location of object in image */
+    double oy_; /** observed y location of object in image */
+    double fx_; /*!< known focal length of camera in x */
+    double fy_; /*!< known focal length of camera in y */
+    double cx_; /*!< known optical center of camera in x */
+    double cy_; /*!< known optical center of camera in y */
+  };
+
+  /** @brief analytic jacobian version of CameraReprjErrorWithDistortion, same residual and parameters */
+  class CameraReprjErrorWithDistortionAnalytic : public ceres::SizedCostFunction<2, 6, 9, 3>
+  {
+  public:
+    CameraReprjErrorWithDistortionAnalytic(double ob_x, double ob_y) :
+        ox_(ob_x), oy_(ob_y)
+    {
+    }
+
+    virtual bool Evaluate(double const* const* parameters, double* resid, double** jacobians) const
+    {
+      const double* c_p1 = parameters[0]; /** extrinsic parameters */
+      const double* c_p2 = parameters[1]; /** intrinsic parameters */
+      const double* point = parameters[2]; /** point being projected */
+      bool need_extrinsics = (jacobians != NULL && jacobians[0] != NULL);
+      bool need_point = (jacobians != NULL && jacobians[2] != NULL);
+
+      int q = 0; /** intrinsic block of parameters */
+      const double& fx = c_p2[q++]; /**  focal length x */
+      const double& fy = c_p2[q++]; /**  focal length x */
+      const double& cx = c_p2[q++]; /**  center point x */
+      const double& cy = c_p2[q++]; /**  center point y */
+      const double& k1 = c_p2[q++]; /**  distortion coefficient on 2nd order terms */
+      const double& k2 = c_p2[q++]; /**  distortion coefficient on 4th order terms */
+      const double& k3 = c_p2[q++]; /**  distortion coefficient on 6th order terms */
+      const double& p1 = c_p2[q++]; /**  tangential distortion coefficient x */
+      const double& p2 = c_p2[q++]; /**  tangential distortion coefficient y */
+
+      double p[3]; /** point in camera frame */
+      double d_p_d_ext[18];
+      double d_p_d_pnt[9];
+      transformPointWithJacobian(c_p1, point, p, need_extrinsics ? d_p_d_ext : NULL, need_point ? d_p_d_pnt : NULL);
+
+      /** scale into the image plane by distance away from camera */
+      const double iz = 1.0 / p[2];
+      const double xp = p[0] * iz;
+      const double yp = p[1] * iz;
+
+      /** calculate terms for polynomial distortion */
+      const double r2 = xp * xp + yp * yp;
+      const double r4 = r2 * r2;
+      const double r6 = r2 * r4;
+      const double radial = 1.0 + k1 * r2 + k2 * r4 + k3 * r6;
+
+      /*apply the distortion coefficients to refine pixel location */
+      const double xpp = xp * radial + p2 * (r2 + 2.0 * xp * xp) + 2.0 * p1 * xp * yp;
+      const double ypp = yp * radial + p1 * (r2 + 2.0 * yp * yp) + 2.0 * p2 * xp * yp;
+
+      /** perform projection using focal length and camera center into image plane */
+      resid[0] = fx * xpp + cx - ox_;
+      resid[1] = fy * ypp + cy - oy_;
+
+      if (jacobians == NULL)
+      {
+        return true;
+      }
+      if (jacobians[1] != NULL)
+      {
+        double* J = jacobians[1];
+        J[0] = xpp; J[1] = 0.0; J[2] = 1.0; J[3] = 0.0;
+        J[4] = fx * r2 * xp; J[5] = fx * r4 * xp; J[6] = fx * r6 * xp;
+        J[7] = fx * 2.0 * xp * yp; J[8] = fx * (r2 + 2.0 * xp * xp);
+        J[9] = 0.0; J[10] = ypp; J[11] = 0.0; J[12] = 1.0;
+        J[13] = fy * r2 * yp; J[14] = fy * r4 * yp; J[15] = fy * r6 * yp;
+        J[16] = fy * (r2 + 2.0 * yp * yp); J[17] = fy * 2.0 * xp * yp;
+      }
+      if (!need_extrinsics && !need_point)
+      {
+        return true;
+      }
+
+      /** derivative of the distorted image point with respect to the undistorted one */
+      const double d_radial = 2.0 * (k1 + 2.0 * k2 * r2 + 3.0 * k3 * r4); /** d(radial)/d(xp) / xp */
+      const double dxpp_dxp = radial + xp * xp * d_radial + 6.0 * p2 * xp + 2.0 * p1 * yp;
+      const double dxpp_dyp = xp * yp * d_radial + 2.0 * p2 * yp + 2.0 * p1 * xp;
+      const double dypp_dxp = xp * yp * d_radial + 2.0 * p1 * xp + 2.0 * p2 * yp;
+      const double dypp_dyp = radial + yp * yp * d_radial + 6.0 * p1 * yp + 2.0 * p2 * xp;
+
+      /** chain through the pinhole division, d(xp,yp)/d(p) */
+      const double d_xp_d_p[3] = { iz, 0.0, -xp * iz };
+      const double d_yp_d_p[3] = { 0.0, iz, -yp * iz };
+      double d_r_d_p[6];
+      for (int c = 0; c < 3; c++)
+      {
+        d_r_d_p[c] = fx * (dxpp_dxp * d_xp_d_p[c] + dxpp_dyp * d_yp_d_p[c]);
+        d_r_d_p[3 + c] = fy * (dypp_dxp * d_xp_d_p[c] + dypp_dyp * d_yp_d_p[c]);
+      }
+      if (need_extrinsics)
+      {
+        multiply2x3By3xN(d_r_d_p, d_p_d_ext, 6, jacobians[0]);
+      }
+      if (need_point)
+      {
+        multiply2x3By3xN(d_r_d_p, d_p_d_pnt, 3, jacobians[2]);
+      }
+      return true;
+    }
+
+    /** Factory to hide the construction of the CostFunction object from */
+    /** the client code. */
+    static ceres::CostFunction* Create(const double o_x, const double o_y)
+    {
+      return (new CameraReprjErrorWithDistortionAnalytic(o_x, o_y));
+    }
+    double ox_; /** observed x location of object in image */
+    double oy_; /** observed y location of object in image */
+  };
+
+  /** @brief all points of one view of a target (one camera, one target, one scene) as a single residual block
+   *         with 2N residuals. Same residual per point as TargetCameraReprjErrorNoDistortion, but the camera
+   *         rotation and its jacobian factor are computed once per evaluation, and the points are stored as
+   *         contiguous arrays. Each point is projected once, for its residuals and its jacobian rows.
+   *         At least one point must be added with addPoint() before the cost is added to a problem,
+   *         ceres rejects a residual block without residuals.
+   */
+  class TargetCameraReprjErrorNoDistortionBatch : public ceres::CostFunction
+  {
+  public:
+    TargetCameraReprjErrorNoDistortionBatch(double fx, double fy, double cx, double cy) :
+        fx_(fx), fy_(fy), cx_(cx), cy_(cy)
+    {
+      mutable_parameter_block_sizes()->push_back(6); /** camera extrinsics */
+      mutable_parameter_block_sizes()->push_back(6); /** target pose, unused as points are in target frame */
+      set_num_residuals(0);
+    }
+
+    /** @brief reserves room for the points of a view
+     *  @param num_points expected number of points
+     */
+    void reserve(int num_points)
+    {
+      ox_.reserve(num_points);
+      oy_.reserve(num_points);
+      pnt_x_.reserve(num_points);
+      pnt_y_.reserve(num_points);
+      pnt_z_.reserve(num_points);
+    }
+
+    /** @brief adds one observed point to the view
+     *  @param ob_x observed x location of point in image
+     *  @param ob_y observed y location of point in image
+     *  @param pnt_x location of point in target's reference frame x
+     *  @param pnt_y location of point in target's reference frame y
+     *  @param pnt_z location of point in target's reference frame z
+     */
+    void addPoint(double ob_x, double ob_y, double pnt_x, double pnt_y, double pnt_z)
+    {
+      ox_.push_back(ob_x);
+      oy_.push_back(ob_y);
+      pnt_x_.push_back(pnt_x);
+      pnt_y_.push_back(pnt_y);
+      pnt_z_.push_back(pnt_z);
+      set_num_residuals(2 * ox_.size());
+    }
+
+    /** @brief number of points in the view */
+    int numPoints() const
+    {
+      return ox_.size();
+    }
+
+    virtual bool Evaluate(double const* const* parameters, double* resid, double** jacobians) const
+    {
+      const double* c_p1 = parameters[0]; /** extrinsic parameters */
+      const int n = ox_.size();
+      double* J = (jacobians != NULL) ? jacobians[0] : NULL;
+
+      /** rotation, and K = R (w w^T + (R^T - I)[w]x) / theta^2 so that d(R*p)/d(w) = -[R*p]x K */
+      double R[9]; /** column major */
+      double K[9]; /** row major */
+      const double theta2 = c_p1[0] * c_p1[0] + c_p1[1] * c_p1[1] + c_p1[2] * c_p1[2];
+      const bool small_angle = (theta2 <= std::numeric_limits<double>::epsilon());
+      if (small_angle)
+      {
+        /** first order approximation used by ceres, R = I + [w]x and d(R*p)/d(w) = -[p]x */
+        R[0] = 1.0;       R[3] = -c_p1[2]; R[6] = c_p1[1];
+        R[1] = c_p1[2];   R[4] = 1.0;      R[7] = -c_p1[0];
+        R[2] = -c_p1[1];  R[5] = c_p1[0];  R[8] = 1.0;
+      }
+      else
+      {
+        ceres::AngleAxisToRotationMatrix(c_p1, R);
+      }
+      if (J != NULL)
+      {
+        if (small_angle)
+        {
+          for (int k = 0; k < 9; k++)
+          {
+            K[k] = (k % 4 == 0) ? 1.0 : 0.0;
+          }
+        }
+        else
+        {
+          const double W[9] = { 0.0, -c_p1[2], c_p1[1],
+                                c_p1[2], 0.0, -c_p1[0],
+                                -c_p1[1], c_p1[0], 0.0 }; /** row major [w]x */
+          double A[9];
+          for (int r = 0; r < 3; r++)
+          {
+            for (int c = 0; c < 3; c++)
+            {
+              double sum = 0.0;
+              for (int k = 0; k < 3; k++)
+              {
+                sum += (R[3 * r + k] - (r == k ? 1.0 : 0.0)) * W[3 * k + c];
+              }
+              A[3 * r + c] = (c_p1[r] * c_p1[c] + sum) / theta2;
+            }
+          }
+          for (int r = 0; r < 3; r++)
+          {
+            for (int c = 0; c < 3; c++)
+            {
+              K[3 * r + c] = R[r] * A[c] + R[r + 3] * A[3 + c] + R[r + 6] * A[6 + c];
+            }
+          }
+        }
+      }
+
+      const double* px = &pnt_x_[0];
+      const double* py = &pnt_y_[0];
+      const double* pz = &pnt_z_[0];
+      const double* ox = &ox_[0];
+      const double* oy = &oy_[0];
+      for (int i = 0; i < n; i++)
+      {
+        /** rotate and translate points into camera frame */
+        const double rx = R[0] * px[i] + R[3] * py[i] + R[6] * pz[i];
+        const double ry = R[1] * px[i] + R[4] * py[i] + R[7] * pz[i];
+        const double rz = R[2] * px[i] + R[5] * py[i] + R[8] * pz[i];
+        const double iz = 1.0 / (rz + c_p1[5]);
+        const double xp = (rx + c_p1[3]) * iz;
+        const double yp = (ry + c_p1[4]) * iz;
+
+        /** perform projection using focal length and camera center into image plane */
+        resid[2 * i] = fx_ * xp + cx_ - ox[i];
+        resid[2 * i + 1] = fy_ * yp + cy_ - oy[i];
+
+        if (J != NULL)
+        {
+          /** the rotated point, or the point itself for the small angle approximation */
+          const double qx = small_angle ? px[i] : rx;
+          const double qy = small_angle ? py[i] : ry;
+          const double qz = small_angle ? pz[i] : rz;
+          const double a = fx_ * iz;
+          const double b = -fx_ * xp * iz;
+          const double c = fy_ * iz;
+          const double d = -fy_ * yp * iz;
+
+          double* J0 = J + 12 * i; /** row 2i */
+          double* J1 = J0 + 6; /** row 2i+1 */
+          for (int k = 0; k < 3; k++)
+          {
+            /** rows of -[q]x K */
+            const double row0 = qz * K[3 + k] - qy * K[6 + k];
+            const double row1 = qx * K[6 + k] - qz * K[k];
+            const double row2 = qy * K[k] - qx * K[3 + k];
+            J0[k] = a * row0 + b * row2;
+            J1[k] = c * row1 + d * row2;
+          }
+          J0[3] = a;
+          J0[4] = 0.0;
+          J0[5] = b;
+          J1[3] = 0.0;
+          J1[4] = c;
+          J1[5] = d;
+        }
+      }
+      if (jacobians != NULL && jacobians[1] != NULL)
+      {
+        std::fill(jacobians[1], jacobians[1] + 12 * n, 0.0);
+      }
+      return true;
+    }
+
+    double fx_; /*!< known focal length of camera in x */
+    double fy_; /*!< known focal length of camera in y */
+    double cx_; /*!< known optical center of camera in x */
+    double cy_; /*!< known optical center of camera in y */
+    std::vector<double> ox_; /*!< observed x locations of the points in image */
+    std::vector<double> oy_; /*!< observed y locations of the points in image */
+    std::vector<double> pnt_x_; /*!< known locations of the points in target's reference frame x */
+    std::vector<double> pnt_y_; /*!< known locations of the points in target's reference frame y */
+    std::vector<double> pnt_z_; /*!< known locations of the points in target's reference frame z */
+  };
+
 } // end of namespace
 #endif
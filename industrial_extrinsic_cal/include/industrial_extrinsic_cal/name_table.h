@@ -0,0 +1,67 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NAME_TABLE_H_
+#define NAME_TABLE_H_
+
+#include <boost/unordered_map.hpp>
+#include <string>
+#include <vector>
+
+namespace industrial_extrinsic_cal
+{
+
+/** \brief Interns camera and target names so the rest of a job can refer to them by dense integer ids
+ *   ids are assigned in order of first appearance starting at 0, and are never reused or removed */
+class NameTable
+{
+public:
+  /** \brief Constructor */
+  NameTable();
+  /** \brief Destructor */
+  ~NameTable();
+
+  /** @brief id of a name, the name is added if it is not already in the table
+   *  @param name the name to look up
+   *  @return the id of the name
+   */
+  int intern(const std::string &name);
+
+  /** @brief id of a name without adding it
+   *  @param name the name to look up
+   *  @return the id of the name, -1 if it is not in the table
+   */
+  int find(const std::string &name) const;
+
+  /** @brief name of an id
+   *  @param id an id previously returned by intern()
+   *  @return the name, an empty string if the id is unknown
+   */
+  const std::string& name(int id) const;
+
+  /** @brief number of names in the table */
+  int size() const;
+
+private:
+  std::vector<std::string> names_; /*!< names indexed by id */
+  boost::unordered_map<std::string, int> ids_; /*!< ids indexed by name */
+};
+
+}//end namespace industrial_extrinsic_cal
+
+#endif /* NAME_TABLE_H_ */
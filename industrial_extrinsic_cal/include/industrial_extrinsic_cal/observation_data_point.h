@@ -20,6 +20,9 @@
 #define OBSERVATION_DATA_POINT_H_
 
 #include <industrial_extrinsic_cal/basic_types.h>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <utility>
 
 namespace industrial_extrinsic_cal
 {
@@ -30,8 +33,8 @@ public:
 
   /**
    *
-   * @param c_name camera name
-   * @param t_name target name
+   * @param c_id camera name id, from the job's name table
+   * @param t_id target name id, from the job's name table
    * @param s_id   scene id
    * @param c_intrinsics  camera's intrinsic parameter block
    * @param c_extrinsics  camera's extrinsic parameter block
@@ -41,11 +44,11 @@ public:
    * @param image_x       image location x
    * @param image_y       image location y
    */
-  ObservationDataPoint(std::string c_name, std::string t_name, int s_id, P_BLOCK c_intrinsics, P_BLOCK c_extrinsics,
+  ObservationDataPoint(int c_id, int t_id, int s_id, P_BLOCK c_intrinsics, P_BLOCK c_extrinsics,
                        int point_id, P_BLOCK t_pose, P_BLOCK p_position, double image_x, double image_y)
   {
-    camera_name_ = c_name;
-    target_name_ = t_name;
+    camera_id_ = c_id;
+    target_id_ = t_id;
     scene_id_ = s_id;
     camera_intrinsics_ = c_intrinsics;
     camera_extrinsics_ = c_extrinsics;
@@ -62,8 +65,8 @@ public:
   }
   ;
 
-  std::string camera_name_;
-  std::string target_name_;
+  int camera_id_; /*!< names are resolved through CeresBlocks::getNameTable() */
+  int target_id_;
   int scene_id_;
   int point_id_;
   P_BLOCK camera_extrinsics_;
@@ -91,6 +94,176 @@ public:
   std::vector<ObservationDataPoint> items;
 };
 
+/**
+ * @brief column store of every observation in a job, one row per observed point
+ *        Each field lives in its own contiguous array, and the parameter blocks are referenced through
+ *        indexes into a table holding each distinct block once. Rows are appended scene by scene,
+ *        so a scene's observations are the rows between sceneBegin() and sceneEnd(). Scenes are
+ *        referred to by their dense index from the job's SceneRegistry, not by their scene id.
+ */
+class ObservationStore
+{
+public:
+  ObservationStore();
+
+  ~ObservationStore();
+
+  /** @brief reserves room so adding up to num_observations rows does not reallocate */
+  void reserve(size_t num_observations);
+
+  /** @brief removes every row, scene and block, the capacity is kept */
+  void clear();
+
+  /** @brief starts a scene, rows added from now on belong to it
+   *  @param scene_index dense index of the scene, see SceneRegistry
+   *  @return false if the scene was already started, its rows would not be contiguous
+   */
+  bool beginScene(int scene_index);
+
+  /** @brief removes the rows of the scene started last and marks it as not started, so it may be observed again,
+   *         the blocks only its rows referenced stay in the block table
+   */
+  void discardScene();
+
+  /**
+   * @brief appends an observation to the current scene
+   * @param camera_id camera name id
+   * @param target_id target name id
+   * @param scene_id scene id
+   * @param point_id id of point in target's list of points
+   * @param intrinsics camera's intrinsic parameter block
+   * @param extrinsics camera's extrinsic parameter block
+   * @param target_pose target's pose parameter block
+   * @param point_position position of point parameter block
+   * @param image_x image location x
+   * @param image_y image location y
+   * @return the new row
+   */
+  int addObservation(int camera_id, int target_id, int scene_id, int point_id, P_BLOCK intrinsics,
+                     P_BLOCK extrinsics, P_BLOCK target_pose, P_BLOCK point_position, double image_x,
+                     double image_y);
+
+  /** @brief number of rows */
+  int size() const
+  {
+    return static_cast<int>(image_x_.size());
+  }
+
+  /** @brief one more than the highest scene index started with beginScene() */
+  int numScenes() const
+  {
+    return static_cast<int>(scene_rows_.size());
+  }
+
+  /** @brief first row of a scene, a scene index which was never started has no rows */
+  int sceneBegin(int scene_index) const
+  {
+    return std::max(scene_rows_[scene_index].first, 0);
+  }
+
+  /** @brief one past the last row of a scene */
+  int sceneEnd(int scene_index) const
+  {
+    return std::max(scene_rows_[scene_index].second, 0);
+  }
+
+  /** @brief number of distinct parameter blocks referenced by the rows */
+  int numBlocks() const
+  {
+    return static_cast<int>(blocks_.size());
+  }
+
+  /** @brief parameter block of a block index */
+  P_BLOCK block(int block_index) const
+  {
+    return blocks_[block_index];
+  }
+
+  double imageX(int row) const
+  {
+    return image_x_[row];
+  }
+  double imageY(int row) const
+  {
+    return image_y_[row];
+  }
+  int cameraId(int row) const
+  {
+    return camera_id_[row];
+  }
+  int targetId(int row) const
+  {
+    return target_id_[row];
+  }
+  int sceneId(int row) const
+  {
+    return scene_id_[row];
+  }
+  int pointId(int row) const
+  {
+    return point_id_[row];
+  }
+  int intrinsicsIndex(int row) const
+  {
+    return intrinsics_[row];
+  }
+  int extrinsicsIndex(int row) const
+  {
+    return extrinsics_[row];
+  }
+  int targetPoseIndex(int row) const
+  {
+    return target_pose_[row];
+  }
+  int pointPositionIndex(int row) const
+  {
+    return point_position_[row];
+  }
+  P_BLOCK intrinsics(int row) const
+  {
+    return blocks_[intrinsics_[row]];
+  }
+  P_BLOCK extrinsics(int row) const
+  {
+    return blocks_[extrinsics_[row]];
+  }
+  P_BLOCK targetPose(int row) const
+  {
+    return blocks_[target_pose_[row]];
+  }
+  P_BLOCK pointPosition(int row) const
+  {
+    return blocks_[point_position_[row]];
+  }
+
+  /** @brief copies a row into an ObservationDataPoint, for printing and debugging */
+  ObservationDataPoint getObservationPoint(int row) const;
+
+private:
+  /** @brief index of a parameter block, the block is added to the table if it is new */
+  int32_t blockIndex(P_BLOCK block);
+
+  /** @brief doubles the slots of the block table and reinserts every block */
+  void growBlockSlots();
+
+  std::vector<double> image_x_; /*!< image location x of each row */
+  std::vector<double> image_y_; /*!< image location y of each row */
+  std::vector<int32_t> camera_id_; /*!< camera name id of each row */
+  std::vector<int32_t> target_id_; /*!< target name id of each row */
+  std::vector<int32_t> scene_id_; /*!< scene id of each row */
+  std::vector<int32_t> point_id_; /*!< point id of each row */
+  std::vector<int32_t> intrinsics_; /*!< block index of the camera intrinsics of each row */
+  std::vector<int32_t> extrinsics_; /*!< block index of the camera extrinsics of each row */
+  std::vector<int32_t> target_pose_; /*!< block index of the target pose of each row */
+  std::vector<int32_t> point_position_; /*!< block index of the point position of each row */
+  std::vector<std::pair<int32_t, int32_t> > scene_rows_; /*!< first and one past the last row of each scene
+                                                             index, -1 for scenes which were not started */
+  int current_scene_; /*!< index of the scene receiving new rows, -1 before the first beginScene() */
+  std::vector<P_BLOCK> blocks_; /*!< every distinct parameter block */
+  std::vector<std::pair<P_BLOCK, int32_t> > block_slots_; /*!< open addressed table of the index of each block
+                                                              in blocks_, a negative index marks an empty slot */
+};
+
 
 }//end namespace industrial_extrinsic_cal
 
@@ -57,7 +57,7 @@ public:
    *  \param target: the target to be observed
    *  \param roi:    the region of interest in the camera's field of view to look for target
    */
-  void addObservationToScene(ObservationCmd observation_command);
+  void addObservationToScene(const ObservationCmd &observation_command);
   /*!
    * \brief Adds a camera to the scene
    * @param cameras_in_scene
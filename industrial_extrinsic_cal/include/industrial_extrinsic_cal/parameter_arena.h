@@ -0,0 +1,77 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARAMETER_ARENA_H_
+#define PARAMETER_ARENA_H_
+
+#include <industrial_extrinsic_cal/basic_types.h>
+#include <boost/noncopyable.hpp>
+#include <vector>
+
+namespace industrial_extrinsic_cal
+{
+
+/** \brief Owns the parameter blocks ceres optimizes in a few large, aligned chunks of doubles
+ *   Blocks are handed out back to back, so blocks allocated together are adjacent in memory.
+ *   A block's address never changes until clear(), which releases every block at once and keeps
+ *   the chunks for reuse. */
+class ParameterArena : boost::noncopyable
+{
+public:
+  /** \brief Constructor
+   *  \param chunk_size number of doubles in each chunk, larger blocks get a chunk of their own
+   */
+  explicit ParameterArena(size_t chunk_size = 4096);
+  /** \brief Destructor, frees every chunk */
+  ~ParameterArena();
+
+  /** @brief allocates a parameter block, the block starts on a 16 byte boundary
+   *  @param size number of doubles in the block
+   *  @param values initial values of the block, left zeroed if NULL
+   *  @return the block, valid until clear()
+   */
+  P_BLOCK allocate(size_t size, const double *values = NULL);
+
+  /** @brief releases every block, the chunks are kept and reused by later allocations */
+  void clear();
+
+  /** @brief number of doubles handed out since the last clear(), including alignment padding */
+  size_t used() const;
+
+  /** @brief number of doubles held in all chunks */
+  size_t capacity() const;
+
+private:
+  /*! \brief a chunk of doubles, data is storage rounded up to the chunk alignment */
+  typedef struct
+  {
+    double *storage;
+    double *data;
+    size_t capacity;
+  } Chunk;
+
+  size_t chunk_size_; /*!< doubles in a regular chunk */
+  std::vector<Chunk> chunks_; /*!< every chunk allocated so far */
+  size_t current_chunk_; /*!< chunk blocks are taken from */
+  size_t chunk_used_; /*!< doubles used in the current chunk */
+  size_t used_; /*!< doubles used in all chunks */
+};
+
+}//end namespace industrial_extrinsic_cal
+
+#endif /* PARAMETER_ARENA_H_ */
@@ -37,6 +37,7 @@
 
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
 #include <sensor_msgs/CameraInfo.h>
 #include <geometry_msgs/PointStamped.h>
 
@@ -55,8 +56,28 @@ typedef pattern_options::pattern_options_ PatternOption;
 namespace industrial_extrinsic_cal
 {
 
+/**
+ *  @brief a target the observer looks for and what it found of it in the last image
+ */
+typedef struct
+{
+  boost::shared_ptr<Target> target; /*!< the target, its observations refer to it by its target_id */
+  PatternOption pattern; /*!< type of pattern to detect */
+  cv::Rect roi; /*!< region of the image searched for the target */
+  int pattern_rows; /*!< target pattern grid number of rows */
+  int pattern_cols; /*!< target pattern grid number of columns */
+  bool sym_circle; /*!< circle grid target pattern true=symmetric */
+  std::vector<cv::Point2f> observation_pts; /*!< 2D values of corner/circle locations returned from cv methods */
+  bool in_image; /*!< the region lies inside the last image, the target is not searched for otherwise */
+  bool found; /*!< the pattern was found in the last image */
+} TargetRequest;
+
+class DetectionPool;
+
 class ROSCameraObserver : public CameraObserver
 {
+  friend class DetectionPool;
+
 public:
 
   /**
@@ -66,15 +87,12 @@ public:
   ROSCameraObserver(const std::string &image_topic);
 
   /**
-   * @brief Default destructor
+   * @brief destructor, waits for the last trigger to return
    */
-  ~ROSCameraObserver()
-  {
-  }
-  ;
+  ~ROSCameraObserver();
 
   /**
-   * @brief add a target to look for and region to look in
+   * @brief add a target to look for and region to look in, every target added is searched for in the same image
    * @param targ a target to look for
    * @param roi Region of interest for target
    * @return true if successful, false if error in setting target or roi
@@ -98,6 +116,13 @@ public:
    */
   int getObservations(CameraObservations &camera_observations);
 
+  /**
+   * @brief return observations without copying them, the caller's previous buffer is kept for the next image
+   * @param camera_observations output observations of targets defined
+   * @return 0 if failed to get observations, 1 if successful
+   */
+  int swapObservations(CameraObservations &camera_observations);
+
   /** @brief tells observer to process next incomming image to find the targets in list */
   void triggerCamera();
 
@@ -106,39 +131,53 @@ public:
 
 private:
 
-  PatternOption pattern_;
   /**
-   * @brief topic name for image which is input at constructor
+   * @brief finds every target in its region of interest of the last image and fills camera_obs_
+   * @return false if none of the targets was found
    */
-  std::string image_topic_;
+  bool findObservations();
+
   /**
-   *  @brief cropped image based on original image and region of interest
+   * @brief detects targets of the current image until none is left unclaimed
+   * @param lock holds request_mutex_, it is released while a target is detected
    */
-  cv::Mat image_roi_;
-  /*!
-   *  @brief cv rectangle region to crop image into
+  void detectTargets(boost::mutex::scoped_lock &lock);
+
+  /**
+   * @brief run by a thread of the shared detection pool, helps with the targets of the current image
    */
-  cv::Rect input_roi_;
+  void helpDetection();
+
   /**
-   *  @brief target pattern grid number of rows
+   * @brief finds the pattern of one target in its region of interest of the last image
+   * @param request the target, receives the points found
    */
-  int pattern_rows_;
+  void detectTarget(TargetRequest &request);
+
+  /**
+   * @brief topic name for image which is input at constructor
+   */
+  std::string image_topic_;
   /**
-   *  @brief target pattern grid number of columns
+   *  @brief targets to find in each image, in the order they were added
    */
-  int pattern_cols_;
+  std::vector<TargetRequest> requests_;
   /**
-   *  @brief circle grid target pattern true=symmetric
+   *  @brief guards the queue of targets while they are detected in parallel
    */
-  bool sym_circle_;
+  boost::mutex request_mutex_;
   /**
-   *  @brief 2D values of corner/circle locations returned from cv methods
+   *  @brief signals findObservations() that every target of the image was detected
    */
-  std::vector<cv::Point2f> observation_pts_;
+  boost::condition_variable detection_done_;
   /**
-   *  @brief private target which is initialized to input target
+   *  @brief index of the next target to detect, guarded by request_mutex_
    */
-  boost::shared_ptr<Target> instance_target_;
+  size_t next_request_;
+  /**
+   *  @brief number of targets of the current image already detected, guarded by request_mutex_
+   */
+  size_t num_detected_;
   /**
    *  @brief private CameraObservations which are set at the end of getObservations and cleared
    */
@@ -154,23 +193,16 @@ private:
    */
   ros::Subscriber image_sub_;
   /**
-   *  @brief ROS publisher of out_bridge_ or output_bridge_
+   *  @brief ROS publisher of the region of interest searched for the target, only filled while subscribed
    */
   ros::Publisher results_pub_;
 
   // Structures for interacting with ROS/CV messages
   /**
-   *  @brief cv_bridge image for input image from ROS topic image_topic_
-   */
-  cv_bridge::CvImagePtr input_bridge_;
-  /**
-   *  @brief cv_bridge image for cropped color output image
-   */
-  cv_bridge::CvImagePtr output_bridge_;
-  /**
-   *  @brief cv_bridge image for cropped mono output image
+   *  @brief mono8 view of the last image from ROS topic image_topic_, it shares the message's pixels
+   *         unless a conversion was needed
    */
-  cv_bridge::CvImagePtr out_bridge_;
+  cv_bridge::CvImageConstPtr input_bridge_;
 
 };
 
@@ -0,0 +1,67 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SCENE_REGISTRY_H_
+#define SCENE_REGISTRY_H_
+
+#include <boost/unordered_map.hpp>
+#include <vector>
+
+namespace industrial_extrinsic_cal
+{
+
+/** \brief Maps the scene ids of a calibration job, which come from the caljob file and may be sparse,
+ *   to dense scene indexes so per scene data can be kept in plain arrays
+ *   indexes are assigned in order of first appearance starting at 0, and are never reused or removed */
+class SceneRegistry
+{
+public:
+  /** \brief Constructor */
+  SceneRegistry();
+  /** \brief Destructor */
+  ~SceneRegistry();
+
+  /** @brief index of a scene id, the id is added if it is not already registered
+   *  @param scene_id the scene id to look up
+   *  @return the dense index of the scene
+   */
+  int add(int scene_id);
+
+  /** @brief index of a scene id without adding it
+   *  @param scene_id the scene id to look up
+   *  @return the dense index of the scene, -1 if it is not registered
+   */
+  int find(int scene_id) const;
+
+  /** @brief scene id of an index
+   *  @param index an index previously returned by add()
+   *  @return the scene id, -1 if the index is unknown
+   */
+  int sceneId(int index) const;
+
+  /** @brief number of registered scenes */
+  int size() const;
+
+private:
+  std::vector<int> scene_ids_; /*!< scene ids indexed by dense index */
+  boost::unordered_map<int, int> indexes_; /*!< dense indexes indexed by scene id */
+};
+
+}//end namespace industrial_extrinsic_cal
+
+#endif /* SCENE_REGISTRY_H_ */
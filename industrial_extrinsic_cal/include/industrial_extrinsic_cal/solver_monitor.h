@@ -0,0 +1,161 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOLVER_MONITOR_H_
+#define SOLVER_MONITOR_H_
+
+#include <boost/thread/mutex.hpp>
+#include "ceres/ceres.h"
+#include <ros/ros.h>
+#include <vector>
+
+namespace industrial_extrinsic_cal
+{
+
+/*! @brief progress of one solver iteration */
+typedef struct
+{
+  int solve_id; /*!< the solve of the iteration, numbered from 0 since SolverMonitor::start() */
+  bool limited; /*!< the time budget and relative improvement stop applied to the solve */
+  int iteration; /*!< iteration within its solve, 0 is the initial state */
+  double cost; /*!< value of the objective */
+  double gradient_max_norm; /*!< max norm of the gradient */
+  double step_time; /*!< seconds spent in this iteration */
+  double linear_solver_time; /*!< seconds the linear solver spent computing this step */
+  double elapsed_time; /*!< seconds since SolverMonitor::start() */
+} IterationRecord;
+
+/*! @brief records the progress of every iteration and ends solves which exceed a time budget or stop improving,
+ *         one monitor may be shared by solves running on several threads, each through its own SolveCallback
+ */
+class SolverMonitor
+{
+public:
+  /*! @brief the callback given to ceres for one solve, records its iterations under a solve id of their own */
+  class SolveCallback : public ceres::IterationCallback
+  {
+  public:
+    /**
+     * @brief constructor, takes the next solve id of the monitor
+     * @param monitor the monitor receiving the records, it must outlive the callback
+     * @param limited whether the time budget and relative improvement stop may end the solve,
+     *        false for auxiliary solves such as the robust solve of outlier pruning
+     */
+    SolveCallback(SolverMonitor &monitor, bool limited) :
+        monitor_(monitor), solve_id_(monitor.nextSolveId()), limited_(limited)
+    {
+    }
+
+    /** @brief called by ceres at the end of every iteration */
+    ceres::CallbackReturnType operator()(const ceres::IterationSummary &summary)
+    {
+      return monitor_.record(solve_id_, limited_, summary);
+    }
+
+    /** @brief the id of the solve in the records */
+    int getSolveId() const
+    {
+      return solve_id_;
+    }
+
+  private:
+    SolverMonitor &monitor_; /*!< receives the records */
+    int solve_id_; /*!< id of this solve */
+    bool limited_; /*!< the stop rules apply to this solve */
+  };
+
+  /** @brief constructor, no time budget and no relative improvement stop */
+  SolverMonitor() :
+      time_budget_(0.0), min_relative_improvement_(0.0), publish_(false), budget_exceeded_(false), next_solve_id_(0)
+  {
+  }
+  ;
+
+  /** @brief clears the records, restarts the solve ids and starts the wall clock of the time budget */
+  void start();
+
+  /**
+   * @brief limits the wall clock time from start() over all the solves it monitors,
+   *        a solve still running when the budget runs out ends with its current estimate
+   * @param seconds the budget, 0 for no limit
+   */
+  void setTimeBudget(double seconds)
+  {
+    time_budget_ = seconds;
+  }
+
+  /**
+   * @brief ends a solve once a successful step reduces the cost by less than this fraction
+   * @param ratio the minimum relative cost decrease, 0 to run until ceres' own convergence criteria
+   */
+  void setMinRelativeImprovement(double ratio)
+  {
+    min_relative_improvement_ = ratio;
+  }
+
+  /**
+   * @brief publishes each record as a std_msgs::Float64MultiArray holding
+   *        [iteration, cost, gradient_max_norm, step_time, linear_solver_time, elapsed_time, solve_id]
+   * @param publisher an advertised publisher
+   */
+  void setPublisher(const ros::Publisher &publisher)
+  {
+    publisher_ = publisher;
+    publish_ = true;
+  }
+
+  /** @brief a copy of the records of every iteration since start(), solves still running may add more */
+  std::vector<IterationRecord> getRecords() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return records_;
+  }
+
+  /** @brief true when a solve was ended by the time budget since start() */
+  bool budgetExceeded() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return budget_exceeded_;
+  }
+
+private:
+  /** @brief the id of a new solve */
+  int nextSolveId();
+
+  /**
+   * @brief records an iteration and applies the stop rules
+   * @param solve_id the solve of the iteration
+   * @param limited whether the stop rules apply to the solve
+   * @param summary the iteration from ceres
+   */
+  ceres::CallbackReturnType record(int solve_id, bool limited, const ceres::IterationSummary &summary);
+
+  double time_budget_; /*!< seconds allowed from start(), 0 for no limit */
+  double min_relative_improvement_; /*!< smallest relative cost decrease that continues a solve */
+  ros::Publisher publisher_; /*!< optional topic receiving the records */
+  bool publish_; /*!< publisher_ has been set */
+  bool budget_exceeded_; /*!< the time budget ended a solve, guarded by mutex_ */
+  ros::WallTime start_time_; /*!< when start() was called */
+  std::vector<IterationRecord> records_; /*!< every iteration since start(), guarded by mutex_ */
+  int next_solve_id_; /*!< id of the next SolveCallback, guarded by mutex_ */
+  mutable boost::mutex mutex_; /*!< guards records_, budget_exceeded_ and next_solve_id_ against other threads */
+};
+
+}//end namespace industrial_extrinsic_cal
+
+#endif /* SOLVER_MONITOR_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SOLVER_PLANNER_H_
+#define SOLVER_PLANNER_H_
+
+#include "ceres/ceres.h"
+#include <string>
+#include <vector>
+
+namespace industrial_extrinsic_cal
+{
+
+/*! @brief the free parameter blocks and residuals of a problem, blocks held constant are not counted */
+typedef struct
+{
+  int num_camera_blocks; /*!< free camera extrinsics and intrinsics blocks, these stay in the reduced system */
+  int num_target_pose_blocks; /*!< free target pose blocks, eliminated by the Schur solvers */
+  int num_point_blocks; /*!< free point blocks, eliminated by the Schur solvers */
+  int num_residual_blocks; /*!< residual blocks in the problem */
+} ProblemStructure;
+
+/*! @brief chooses the linear solver, preconditioner and thread count for a problem from its structure,
+ *         and optionally times the candidate solvers on the real problem
+ */
+class SolverPlanner
+{
+public:
+  /** @brief constructor, uses up to one thread per core */
+  SolverPlanner();
+
+  /**
+   * @brief sets the linear solver, preconditioner and thread count of options for a problem,
+   *        the Schur solvers keep Ceres' automatic elimination ordering unless options already holds one
+   * @param structure the free blocks of the problem
+   * @param options the options to configure
+   */
+  void plan(const ProblemStructure &structure, ceres::Solver::Options &options) const;
+
+  /**
+   * @brief plans the problem and then picks the fastest linear solver by timing a few iterations of every
+   *        candidate on the problem, the parameter blocks are restored after each trial.
+   *        The winner is cached under the key and the free block counts of the structure, a later call
+   *        with the same key and structure skips the trials.
+   * @param problem the problem which is about to be solved
+   * @param structure the free blocks of the problem
+   * @param ordering elimination ordering given to the Schur candidates, NULL for Ceres' automatic ordering
+   * @param cache_key identifies the job, e.g. the calibration job file name, jobs without a file share ""
+   * @param options the options to configure, the ordering is not attached to them
+   */
+  void autoTune(ceres::Problem &problem, const ProblemStructure &structure,
+                const ceres::ParameterBlockOrdering *ordering, const std::string &cache_key,
+                ceres::Solver::Options &options);
+
+  /**
+   * @brief gives the options their own copy of an elimination ordering if their linear solver is a Schur solver
+   * @param ordering the ordering
+   * @param options the options, they own the copy
+   * @return true if the ordering was attached
+   */
+  static bool attachOrdering(const ceres::ParameterBlockOrdering &ordering, ceres::Solver::Options &options);
+
+  /**
+   * @brief limits the threads used by the solver
+   * @param max_threads the most threads to use, at least 1
+   */
+  void setMaxThreads(int max_threads)
+  {
+    max_threads_ = max_threads;
+  }
+
+  /**
+   * @brief iterations run when timing each candidate in autoTune()
+   * @param iterations iterations per candidate
+   */
+  void setTuneIterations(int iterations)
+  {
+    tune_iterations_ = iterations;
+  }
+
+  /**
+   * @brief reads auto-tuned solvers cached by a previous process
+   * @param file_name yaml file written by saveCache()
+   * @return true if successful
+   */
+  static bool loadCache(const std::string &file_name);
+
+  /**
+   * @brief writes every auto-tuned solver so later processes skip the trials
+   * @param file_name the yaml file
+   * @return true if successful
+   */
+  static bool saveCache(const std::string &file_name);
+
+protected:
+  /**
+   * @brief the linear solvers suited to a structure, the planned one first
+   * @param structure the free blocks of the problem
+   * @param options the planned options
+   * @param candidates output, the planned options followed by the alternatives
+   */
+  void candidateOptions(const ProblemStructure &structure, const ceres::Solver::Options &options,
+                        std::vector<ceres::Solver::Options> &candidates) const;
+
+private:
+  int max_threads_; /*!< most threads given to the solver */
+  int tune_iterations_; /*!< iterations timed per candidate by autoTune() */
+};
+
+}//end namespace industrial_extrinsic_cal
+
+#endif /* SOLVER_PLANNER_H_ */
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <ros/ros.h>
 #include <industrial_extrinsic_cal/basic_types.h>
+#include <industrial_extrinsic_cal/solver_planner.h>
 #include <boost/foreach.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/linear_congruential.hpp>
@@ -296,9 +297,15 @@ int main(int argc, char** argv)
 
   }
 
-  // solve problem
+  // solve problem, every camera is free and the fiducials are held constant
+  industrial_extrinsic_cal::ProblemStructure structure;
+  structure.num_camera_blocks = cameras.size();
+  structure.num_target_pose_blocks = 0;
+  structure.num_point_blocks = 0;
+  structure.num_residual_blocks = problem1.NumResidualBlocks();
   ceres::Solver::Options options;
-  options.linear_solver_type = ceres::DENSE_SCHUR;
+  industrial_extrinsic_cal::SolverPlanner planner;
+  planner.plan(structure, options);
   options.minimizer_progress_to_stdout = false;
   options.max_num_iterations = 1000;
   
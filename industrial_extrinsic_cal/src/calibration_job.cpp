@@ -674,6 +674,8 @@ bool CalibrationJob::runOptimization()
     // Make Ceres automatically detect the bundle structure. Note that the
     // standard solver, SPARSE_NORMAL_CHOLESKY, also works fine but it is slower
     // for standard bundle adjustment problems.
+    // This prototype is not built and never solves, the job in calibration_job_definition.cpp
+    // chooses its solver with SolverPlanner
     ceres::Solver::Options options;
     options.linear_solver_type = ceres::DENSE_SCHUR;
     options.minimizer_progress_to_stdout = true;
@@ -20,6 +20,13 @@
 #include <boost/foreach.hpp>
 #include <boost/shared_ptr.hpp>
 #include <ros/package.h>
+#include <ros/time.h>
+#include <boost/bind.hpp>
+#include <boost/unordered_set.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
 
 using std::string;
 using boost::shared_ptr;
@@ -49,7 +56,7 @@ bool CalibrationJob::load()
     ROS_ERROR_STREAM("Target file parsing failed");
     return false;
   }
-  if(CalibrationJob::loadCalJob())
+  if(CalibrationJob::loadCalJob(caljob_def_file_name_))
   {
     ROS_INFO_STREAM("Successfully read in CalJob");
   }
@@ -75,7 +82,6 @@ bool CalibrationJob::loadCamera()
 
   string temp_name, temp_topic, camera_optical_frame, camera_intermediate_frame;
   CameraParameters temp_parameters;
-  P_BLOCK extrinsics;
 
   unsigned int scene_id;
   try
@@ -113,10 +119,12 @@ bool CalibrationJob::loadCamera()
         shared_ptr<Camera> temp_camera = make_shared<Camera>(temp_name, temp_parameters, false);
         temp_camera->camera_observer_ = make_shared<ROSCameraObserver>(temp_topic);
         ceres_blocks_.addStaticCamera(temp_camera);
+        defineCamera(temp_camera);
         camera_optical_frames_.push_back(camera_optical_frame);
         camera_intermediate_frames_.push_back(camera_intermediate_frame);
-        extrinsics = ceres_blocks_.getStaticCameraParameterBlockExtrinsics(temp_name);
-        original_extrinsics_.push_back(extrinsics);
+        // a copy, the parameter blocks are reused by every run
+        original_extrinsics_.push_back(
+            std::vector<double>(temp_parameters.pb_extrinsics, temp_parameters.pb_extrinsics + 6));
        }
     }
 
@@ -149,10 +157,13 @@ bool CalibrationJob::loadCamera()
         shared_ptr<Camera> temp_camera = make_shared<Camera>(temp_name, temp_parameters, true);
         temp_camera->camera_observer_ = make_shared<ROSCameraObserver>(temp_topic);
         ceres_blocks_.addMovingCamera(temp_camera, scene_id);
+        // a moving camera shadows a static one of the same name, as in the blocks
+        defineCamera(temp_camera);
         camera_optical_frames_.push_back(camera_optical_frame);
         camera_intermediate_frames_.push_back(camera_intermediate_frame);
-        extrinsics = ceres_blocks_.getStaticCameraParameterBlockExtrinsics(temp_name);
-        original_extrinsics_.push_back(extrinsics);
+        // a copy, the parameter blocks are reused by every run
+        original_extrinsics_.push_back(
+            std::vector<double>(temp_parameters.pb_extrinsics, temp_parameters.pb_extrinsics + 6));
       }
     }
   } // end try
@@ -193,7 +204,6 @@ bool CalibrationJob::loadTarget()
         << target_def_file_name_.c_str());
     return (false);
   }
-  Target temp_target;
   std::string temp_frame;
   try
   {
@@ -205,10 +215,11 @@ bool CalibrationJob::loadTarget()
     if (const YAML::Node *target_parameters = target_doc.FindValue("static_targets"))
     {
       ROS_DEBUG_STREAM("Found "<<target_parameters->size() <<" targets ");
-      shared_ptr<Target> temp_target = make_shared<Target>();
-      temp_target->is_moving = false;
       for (unsigned int i = 0; i < target_parameters->size(); i++)
       {
+        // every target needs its own object, the registry and the blocks keep a pointer to it
+        shared_ptr<Target> temp_target = make_shared<Target>();
+        temp_target->is_moving = false;
         (*target_parameters)[i]["target_name"] >> temp_target->target_name;
         (*target_parameters)[i]["target_frame"] >> temp_frame;
         (*target_parameters)[i]["target_type"] >> temp_target->target_type;
@@ -253,6 +264,7 @@ bool CalibrationJob::loadTarget()
           temp_target->pts.push_back(temp_pnt3d);
         }
         ceres_blocks_.addStaticTarget(temp_target);
+        defineTarget(temp_target);
         target_frames_.push_back(temp_frame);
       }
     }
@@ -261,11 +273,11 @@ bool CalibrationJob::loadTarget()
     if (const YAML::Node *target_parameters = target_doc.FindValue("moving_targets"))
     {
       ROS_DEBUG_STREAM("Found "<<target_parameters->size() <<"  moving targets ");
-      shared_ptr<Target> temp_target = make_shared<Target>();
       unsigned int scene_id;
-      temp_target->is_moving = true;
       for (unsigned int i = 0; i < target_parameters->size(); i++)
       {
+        shared_ptr<Target> temp_target = make_shared<Target>();
+        temp_target->is_moving = true;
         (*target_parameters)[i]["target_name"] >> temp_target->target_name;
         (*target_parameters)[i]["target_frame"] >> temp_frame;
         (*target_parameters)[i]["target_type"] >> temp_target->target_type;
@@ -308,6 +320,7 @@ bool CalibrationJob::loadTarget()
           temp_target->pts.push_back(temp_pnt3d);
         }
         ceres_blocks_.addMovingTarget(temp_target, scene_id);
+        defineTarget(temp_target);
         target_frames_.push_back(temp_frame);
       }
     }
@@ -322,27 +335,31 @@ bool CalibrationJob::loadTarget()
 
 }
 
-bool CalibrationJob::loadCalJob()
+bool CalibrationJob::loadCalJob(const std::string &caljob_fn, int scene_id_offset)
 {
-  std::ifstream caljob_input_file(caljob_def_file_name_.c_str());
+  std::ifstream caljob_input_file(caljob_fn.c_str());
   if (caljob_input_file.fail())
   {
     ROS_ERROR_STREAM(
         "ERROR CalibrationJob::load(), couldn't open caljob_input_file: "
-        << caljob_def_file_name_.c_str());
+        << caljob_fn.c_str());
     return (false);
   }
 
   std::string trigger_message="triggered";//TODO what's in the message?
   std::string opt_params;
+  std::string reference_frame;
   int scene_id_num;
   int trig_type;
   Trigger cal_trig;
   cal_trig.trigger_popup_msg=trigger_message;
   std::string camera_name;
-  shared_ptr<Camera> temp_cam = make_shared<Camera>();
-  shared_ptr<Target> temp_targ = make_shared<Target>();
+  std::string target_name;
+  shared_ptr<Camera> temp_cam;
+  shared_ptr<Target> temp_targ;
   Roi temp_roi;
+  // scenes are appended, so a file loaded after the first one extends the job
+  size_t first_scene = scene_list_.size();
 
   try
   {
@@ -350,40 +367,72 @@ bool CalibrationJob::loadCalJob()
     YAML::Node caljob_doc;
     caljob_parser.GetNextDocument(caljob_doc);
 
-    caljob_doc["reference_frame"] >> reference_frame_;
+    caljob_doc["reference_frame"] >> reference_frame;
+    if (first_scene > 0 && reference_frame != reference_frame_)
+    {
+      ROS_ERROR_STREAM("Calibration job "<<caljob_fn<<" uses reference frame "<<reference_frame
+                       <<" but the job is calibrated to "<<reference_frame_);
+      return false;
+    }
+    reference_frame_ = reference_frame;
     caljob_doc["optimization_parameters"] >> opt_params;
     // read in all scenes
     if (const YAML::Node *caljob_scenes = caljob_doc.FindValue("scenes"))
     {
       ROS_DEBUG_STREAM("Found "<<caljob_scenes->size() <<" scenes");
-      scene_list_.resize(caljob_scenes->size() );
+      // scene ids may be sparse, they only have to be unique within the job
+      boost::unordered_set<int> scene_ids;
+      for (size_t k = 0; k < first_scene; k++)
+      {
+        scene_ids.insert(scene_list_[k].get_id());
+      }
+      scene_list_.resize(first_scene + caljob_scenes->size());
       for (unsigned int i = 0; i < caljob_scenes->size(); i++)
       {
+        ObservationScene &scene = scene_list_.at(first_scene + i);
         (*caljob_scenes)[i]["scene_id"] >> scene_id_num;
+        scene_id_num += scene_id_offset;
         //ROS_INFO_STREAM("scene "<<scene_id_num);
+        if (!scene_ids.insert(scene_id_num).second)
+        {
+          ROS_ERROR_STREAM("Calibration job "<<caljob_fn<<" repeats scene_id "<<scene_id_num);
+          scene_list_.resize(first_scene);
+          return false;
+        }
         (*caljob_scenes)[i]["trigger_type"] >> trig_type;
         //ROS_INFO_STREAM("trig type "<<trig_type);
         cal_trig.trigger_type=trig_type;
-        scene_list_.at(i).setTrig(cal_trig);
-        scene_list_.at(i).setSceneId(scene_id_num);
+        scene.setTrig(cal_trig);
+        scene.setSceneId(scene_id_num);
         const YAML::Node *obs_node = (*caljob_scenes)[i].FindValue("observations");
         ROS_DEBUG_STREAM("Found "<<obs_node->size() <<" observations within scene "<<i);
         for (unsigned int j = 0; j < obs_node->size(); j++)
         {
           //ROS_INFO_STREAM("For obs "<<j);
           (*obs_node)[j]["camera"] >> camera_name;
-          temp_cam = ceres_blocks_.getCameraByName(camera_name);
+          (*obs_node)[j]["target"] >> target_name;
+          // the blocks only hold what the last run observed, the names are resolved against the loaded files
+          std::map<std::string, shared_ptr<Camera> >::const_iterator camera = defined_cameras_.find(camera_name);
+          std::map<std::string, shared_ptr<Target> >::const_iterator target = defined_targets_.find(target_name);
+          if (camera == defined_cameras_.end() || target == defined_targets_.end())
+          {
+            ROS_ERROR_STREAM("Calibration job "<<caljob_fn<<" scene "<<scene_id_num<<" names "
+                             <<(camera == defined_cameras_.end() ? "camera "+camera_name : "target "+target_name)
+                             <<" which is not defined");
+            scene_list_.resize(first_scene);
+            return false;
+          }
+          temp_cam = camera->second;
+          temp_targ = target->second;
 
-          scene_list_.at(i).addCameraToScene(temp_cam);
+          scene.addCameraToScene(temp_cam);
 
           (*obs_node)[j]["roi_x_min"] >> temp_roi.x_min;
           (*obs_node)[j]["roi_x_max"] >> temp_roi.x_max;
           (*obs_node)[j]["roi_y_min"] >> temp_roi.y_min;
           (*obs_node)[j]["roi_y_max"] >> temp_roi.y_max;
-          (*obs_node)[j]["target"] >> temp_targ->target_name;
-          temp_targ = ceres_blocks_.getTargetByName(temp_targ->target_name);
 
-          scene_list_.at(i).populateObsCmdList(temp_cam, temp_targ, temp_roi);
+          scene.populateObsCmdList(temp_cam, temp_targ, temp_roi);
         }
       }
     }
@@ -392,123 +441,467 @@ bool CalibrationJob::loadCalJob()
   {
     ROS_ERROR("load() Failed to read in caljob yaml file");
     ROS_ERROR_STREAM("Failed with exception "<< e.what());
+    scene_list_.resize(first_scene);
     return (false);
   }
   return true;
 }
 
-bool CalibrationJob::run()
+void CalibrationJob::defineCamera(const shared_ptr<Camera> &camera)
 {
-  runObservations();
-  runOptimization();
+  defined_cameras_[camera->camera_name_] = camera;
+}
+
+void CalibrationJob::defineTarget(const shared_ptr<Target> &target)
+{
+  defined_targets_[target->target_name] = target;
+}
+
+bool CalibrationJob::appendScenes(const std::string &caljob_fn)
+{
+  size_t num_scenes = scene_list_.size();
+  // the ids of the appended scenes follow every id in the job, so appending a file again adds fresh scenes
+  int scene_id_offset = 0;
+  BOOST_FOREACH(ObservationScene &scene, scene_list_)
+  {
+    scene_id_offset = std::max(scene_id_offset, scene.get_id() + 1);
+  }
+  if (!loadCalJob(caljob_fn, scene_id_offset))
+  {
+    ROS_ERROR_STREAM("Failed to append the scenes of "<<caljob_fn);
+    return false;
+  }
+  ROS_INFO_STREAM("Appended "<<scene_list_.size() - num_scenes<<" scenes from "<<caljob_fn);
   return true;
 }
 
+bool CalibrationJob::run()
+{
+  return runObservations() && runOptimization();
+}
+
+bool CalibrationJob::runIncremental()
+{
+  if (!has_solution_)
+  {
+    ROS_INFO_STREAM("No previous solution, running the complete calibration job");
+    return run();
+  }
+  ROS_INFO_STREAM("Warm starting from the previous solution with "<<scene_list_.size() - num_observed_scenes_
+                  <<" new scenes");
+  if (!observeNewScenes())
+  {
+    return false;
+  }
+  return runOptimization();
+}
+
 bool CalibrationJob::runObservations()
 {
   ROS_DEBUG_STREAM("Running observations...");
   this->ceres_blocks_.clearCamerasTargets();
-  // For each scene
-  BOOST_FOREACH(ObservationScene current_scene, scene_list_)
-  {
-    int scene_id = current_scene.get_id();
-
-    // clear all observations from every camera
-    ROS_DEBUG_STREAM("Processing Scene " << scene_id<<" of "<< scene_list_.size());
+  // the stored observations, the results and the problems point into the blocks just cleared, whose memory the
+  // arena hands out again
+  observation_store_.clear();
+  extrinsics_.clear();
+  target_pose_.clear();
+  extrinsics_covariance_.clear();
+  target_pose_covariance_.clear();
+  block_problems_.clear();
+  component_problems_.clear();
+  problem_.reset(new ceres::Problem());
+  num_observed_scenes_ = 0;
+  has_solution_ = false;
+  return observeNewScenes();
+}
 
-    // add observations to every camera
-    //ROS_INFO_STREAM("Processing " << current_scene.cameras_in_scene_.size() <<" Cameras ");
-    BOOST_FOREACH(shared_ptr<Camera> current_camera, current_scene.cameras_in_scene_)
+bool CalibrationJob::observeNewScenes()
+{
+  // every commanded target point may be seen once, so the store never grows while observing
+  size_t expected_observations = observation_store_.size();
+  for (size_t i = num_observed_scenes_; i < scene_list_.size(); i++)
+  {
+    BOOST_FOREACH(const ObservationCmd &o_command, scene_list_[i].observation_command_list_)
     {
-      //ROS_INFO_STREAM("Current Camera name: "<<current_camera->camera_name_);
-      current_camera->camera_observer_->clearObservations(); // clear any recorded data
-      current_camera->camera_observer_->clearTargets(); // clear all targets
+      expected_observations += o_command.target->pts.size();
     }
+  }
+  observation_store_.reserve(expected_observations);
 
-    // add each target to each cameras observations
-    ROS_DEBUG_STREAM("Processing " << current_scene.observation_command_list_.size()
-                     <<" Observation Commands");
-    BOOST_FOREACH(ObservationCmd o_command, current_scene.observation_command_list_)
+  // scenes pass through acquisition on this thread, detection on workers and registration back on this thread,
+  // so a scene is acquired while up to pipeline_depth_ - 1 earlier scenes are still being detected
+  size_t depth = std::max<size_t>(1, pipeline_depth_);
+  while (scene_acquisitions_.size() < depth)
+  {
+    scene_acquisitions_.push_back(boost::make_shared<SceneAcquisition>());
+  }
+  // a worker for every camera of every scene in flight, so a triggered camera never waits for a worker,
+  // the workers wait for the next run between runs, so a recalibration only starts the workers it lacks
+  size_t max_cameras = 1;
+  for (size_t i = num_observed_scenes_; i < scene_list_.size(); i++)
+  {
+    std::set<CameraObserver*> observers;
+    BOOST_FOREACH(const shared_ptr<Camera> &camera, scene_list_[i].cameras_in_scene_)
     {
-      // configure to find target in roi
-      o_command.camera->camera_observer_->addTarget(o_command.target, o_command.roi);
-      //ROS_INFO_STREAM("Current Camera name: "<<o_command.camera->camera_name_);
-      //ROS_INFO_STREAM("Current Target name: "<<o_command.target->target_name);
-      //ROS_INFO_STREAM("Current roi xmin: "<<o_command.roi.x_min);
+      observers.insert(camera->camera_observer_.get());
     }
-    // trigger the cameras
-    BOOST_FOREACH( shared_ptr<Camera> current_camera, current_scene.cameras_in_scene_)
+    BOOST_FOREACH(const ObservationCmd &o_command, scene_list_[i].observation_command_list_)
     {
-      current_camera->camera_observer_->triggerCamera();
+      observers.insert(o_command.camera->camera_observer_.get());
     }
-    // collect results
-    P_BLOCK intrinsics;
-    P_BLOCK extrinsics;
-    P_BLOCK target_pose;
-    P_BLOCK pnt_pos;
-    std::string camera_name;
-    std::string target_name;
-    /*ROS_INFO_STREAM("static camera extrinsics: "<<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[0]<<" "
-                             <<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[1]<<" "
-                             <<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[2]);*/
+    max_cameras = std::max(max_cameras, observers.size());
+  }
+  while (detection_workers_.size() < depth * max_cameras)
+  {
+    detection_workers_.create_thread(boost::bind(&CalibrationJob::detectionWorker, this));
+  }
 
-    // for each camera in scene
-      ObservationDataPointList listpercamera;
-    BOOST_FOREACH( shared_ptr<Camera> camera, current_scene.cameras_in_scene_)
+  std::deque<SceneAcquisition*> in_flight;
+  size_t next_scene = num_observed_scenes_;
+  bool rtn = true;
+  while (num_observed_scenes_ < scene_list_.size())
+  {
+    if (next_scene < scene_list_.size() && in_flight.size() < depth
+        && camerasIdle(scene_list_[next_scene], in_flight))
     {
+      // the scenes in flight are consecutive, so they never share an acquisition
+      SceneAcquisition *acquisition = scene_acquisitions_[next_scene % depth].get();
+      if (!acquireScene(next_scene, *acquisition))
+      {
+        rtn = false;
+        break;
+      }
+      in_flight.push_back(acquisition);
+      next_scene++;
+    }
+    else
+    {
+      // scenes are registered in order, so the blocks and rows do not depend on the detection timing
+      SceneAcquisition *acquisition = in_flight.front();
+      in_flight.pop_front();
+      if (!registerScene(*acquisition))
+      {
+        rtn = false;
+        break;
+      }
+      num_observed_scenes_++;
+    }
+  }
+  // the workers refer to the acquisitions, every one of them has to finish before returning
+  BOOST_FOREACH(SceneAcquisition *acquisition, in_flight)
+  {
+    checkAcquisition(*acquisition);
+  }
+  return rtn;
+}
 
-      // wait until observation is done
-      while (!camera->camera_observer_->observationsDone())
-        ;
+void CalibrationJob::registerTarget(const shared_ptr<Target> &target)
+{
+  // name ids are shared with the cameras, so the table may have empty entries
+  // the id is only written once, workers detecting earlier scenes may be reading it
+  int target_id = ceres_blocks_.getNameId(target->target_name);
+  if (target->target_id != target_id)
+  {
+    target->target_id = target_id;
+  }
+  // name ids are never negative
+  size_t table_index = static_cast<size_t>(target_id);
+  if (table_index >= target_table_.size())
+  {
+    target_table_.resize(table_index + 1);
+  }
+  target_table_[table_index] = target;
+}
 
-      camera_name = camera->camera_name_;
-      if (camera->isMoving())
+/** @brief appends a camera to a list unless a camera with the same observer is listed already */
+static void appendCamera(std::vector<shared_ptr<Camera> > &cameras, const shared_ptr<Camera> &camera)
+{
+  BOOST_FOREACH(const shared_ptr<Camera> &listed, cameras)
+  {
+    if (listed->camera_observer_ == camera->camera_observer_)
+    {
+      return;
+    }
+  }
+  cameras.push_back(camera);
+}
+
+bool CalibrationJob::camerasIdle(const ObservationScene &scene, const std::deque<SceneAcquisition*> &in_flight)
+{
+  // an observer holds a single frame, so it is only reconfigured once the scenes in flight are done with it
+  BOOST_FOREACH(const SceneAcquisition *acquisition, in_flight)
+  {
+    for (size_t i = 0; i < acquisition->cameras.size(); i++)
+    {
+      if (acquisition->detections[i]->result() != trigger_results::Pending
+          && acquisition->triggers[i]->result() != trigger_results::Pending)
       {
-        // next line does nothing if camera already exist in blocks
-        ceres_blocks_.addMovingCamera(camera, scene_id);
-        intrinsics = ceres_blocks_.getMovingCameraParameterBlockIntrinsics(camera_name);
-        extrinsics = ceres_blocks_.getMovingCameraParameterBlockExtrinsics(camera_name, scene_id);
+        continue;
       }
-      else
+      const shared_ptr<CameraObserver> &busy = acquisition->cameras[i]->camera_observer_;
+      BOOST_FOREACH(const shared_ptr<Camera> &camera, scene.cameras_in_scene_)
+      {
+        if (camera->camera_observer_ == busy)
+        {
+          return false;
+        }
+      }
+      BOOST_FOREACH(const ObservationCmd &o_command, scene.observation_command_list_)
       {
-        // next line does nothing if camera already exist in blocks
-        ceres_blocks_.addStaticCamera(camera);
-        intrinsics = ceres_blocks_.getStaticCameraParameterBlockIntrinsics(camera_name);
-        extrinsics = ceres_blocks_.getStaticCameraParameterBlockExtrinsics(camera_name);
+        if (o_command.camera->camera_observer_ == busy)
+        {
+          return false;
+        }
       }
+    }
+  }
+  return true;
+}
+
+bool CalibrationJob::acquireScene(size_t scene, SceneAcquisition &acquisition)
+{
+  ObservationScene &current_scene = scene_list_[scene];
+  int scene_id = current_scene.get_id();
+  ROS_DEBUG_STREAM("Processing Scene " << scene_id<<" of "<< scene_list_.size());
+
+  // every camera the scene configures, a camera is listed once for each of its observation commands
+  // but it is only configured and triggered once
+  acquisition.scene = scene;
+  acquisition.cameras.clear();
+  acquisition.triggers.clear();
+  acquisition.detections.clear();
+  BOOST_FOREACH(const shared_ptr<Camera> &current_camera, current_scene.cameras_in_scene_)
+  {
+    appendCamera(acquisition.cameras, current_camera);
+  }
+  BOOST_FOREACH(const ObservationCmd &o_command, current_scene.observation_command_list_)
+  {
+    appendCamera(acquisition.cameras, o_command.camera);
+  }
+
+  // a camera which timed out in an earlier scene may still be inside its trigger or detection,
+  // no observer of the scene is touched unless every one of them is free
+  BOOST_FOREACH(const shared_ptr<Camera> &camera, acquisition.cameras)
+  {
+    std::map<CameraObserver*, shared_ptr<TriggerCompletion> >::iterator pending
+        = pending_triggers_.find(camera->camera_observer_.get());
+    if (pending != pending_triggers_.end() && pending->second->result() == trigger_results::Pending)
+    {
+      ROS_ERROR_STREAM("Camera "<<camera->camera_name_<<" has not returned from its previous trigger");
+      acquisition.cameras.clear();
+      return false;
+    }
+  }
+  BOOST_FOREACH(const shared_ptr<Camera> &camera, acquisition.cameras)
+  {
+    pending_triggers_.erase(camera->camera_observer_.get());
+  }
+
+  // clear all observations and targets from every camera
+  BOOST_FOREACH(const shared_ptr<Camera> &camera, acquisition.cameras)
+  {
+    camera->camera_observer_->clearObservations(); // clear any recorded data
+    camera->camera_observer_->clearTargets(); // clear all targets
+    camera->camera_observer_->setTriggerTimeout(camera_timeout_); // a trigger gives up with its scene
+  }
+
+  // add each target to each cameras observations
+  ROS_DEBUG_STREAM("Processing " << current_scene.observation_command_list_.size()
+                   <<" Observation Commands");
+  BOOST_FOREACH(ObservationCmd &o_command, current_scene.observation_command_list_)
+  {
+    // configure to find target in roi
+    registerTarget(o_command.target);
+    o_command.camera->camera_observer_->addTarget(o_command.target, o_command.roi);
+  }
 
-      // Get the observations
-      CameraObservations camera_observations;
-      int number_returned;
-      number_returned = camera->camera_observer_->getObservations(camera_observations);
+  // trigger the cameras together since a ROSCameraObserver blocks until its next image arrives,
+  // so the scene waits one frame period for the slowest camera rather than one period per camera
+  acquisition.results.assign(acquisition.cameras.size(), trigger_results::Pending);
+  acquisition.observations.resize(acquisition.cameras.size());
+  BOOST_FOREACH(const shared_ptr<Camera> &camera, acquisition.cameras)
+  {
+    acquisition.triggers.push_back(camera->camera_observer_->triggerCameraAsync());
+    acquisition.detections.push_back(boost::make_shared<TriggerCompletion>());
+  }
+  // all cameras share one deadline so the scene waits at most camera_timeout_
+  acquisition.deadline = boost::get_system_time()
+      + boost::posix_time::microseconds(static_cast<int64_t>(camera_timeout_ * 1.0e6));
+
+  // the detection of each camera runs on its own worker while the next scene is acquired
+  {
+    boost::mutex::scoped_lock lock(detection_mutex_);
+    for (size_t i = 0; i < acquisition.cameras.size(); i++)
+    {
+      detection_queue_.push_back(std::make_pair(&acquisition, i));
+    }
+  }
+  detection_queued_.notify_all();
+  return true;
+}
+
+void CalibrationJob::detectionWorker()
+{
+  boost::mutex::scoped_lock lock(detection_mutex_);
+  while (true)
+  {
+    while (detection_queue_.empty() && !stop_detection_)
+    {
+      detection_queued_.wait(lock);
+    }
+    if (detection_queue_.empty())
+    {
+      return;
+    }
+    std::pair<SceneAcquisition*, size_t> task = detection_queue_.front();
+    detection_queue_.pop_front();
+    lock.unlock();
+    detectCamera(task.first, task.second);
+    lock.lock();
+  }
+}
+
+void CalibrationJob::stopDetectionWorkers()
+{
+  {
+    boost::mutex::scoped_lock lock(detection_mutex_);
+    stop_detection_ = true;
+  }
+  detection_queued_.notify_all();
+  detection_workers_.join_all();
+}
+
+void CalibrationJob::detectCamera(SceneAcquisition *acquisition, size_t camera)
+{
+  TriggerResult result = acquisition->triggers[camera]->wait(acquisition->deadline);
+  acquisition->results[camera] = result;
+  if (result == trigger_results::Done)
+  {
+    // Get the observations, the buffers are swapped with the observer so they are never copied
+    acquisition->observations[camera].observations.clear();
+    acquisition->cameras[camera]->camera_observer_->swapObservations(acquisition->observations[camera]);
+  }
+  // completing the handle publishes the result and the observations to the job thread, which may reuse the
+  // acquisition right after, so the handle is kept alive by the worker until complete() returns
+  boost::shared_ptr<TriggerCompletion> detection = acquisition->detections[camera];
+  detection->complete(result == trigger_results::Done);
+}
+
+bool CalibrationJob::checkAcquisition(SceneAcquisition &acquisition)
+{
+  int scene_id = scene_list_[acquisition.scene].get_id();
+  bool all_done = true;
+  for (size_t i = 0; i < acquisition.cameras.size(); i++)
+  {
+    acquisition.detections[i]->wait();
+    if (acquisition.results[i] == trigger_results::TimedOut)
+    {
+      ROS_ERROR_STREAM("Camera "<<acquisition.cameras[i]->camera_name_<<" did not complete its observations within "
+                       <<camera_timeout_<<" seconds");
+      pending_triggers_[acquisition.cameras[i]->camera_observer_.get()] = acquisition.triggers[i];
+      all_done = false;
+    }
+    else if (acquisition.results[i] == trigger_results::Failed)
+    {
+      ROS_ERROR_STREAM("Camera "<<acquisition.cameras[i]->camera_name_<<" failed to observe scene "<<scene_id);
+      all_done = false;
+    }
+  }
+  return all_done;
+}
+
+bool CalibrationJob::registerScene(SceneAcquisition &acquisition)
+{
+  if (!checkAcquisition(acquisition))
+  {
+    return false;
+  }
+  int scene_id = scene_list_[acquisition.scene].get_id();
+
+  // collect results
+  P_BLOCK intrinsics;
+  P_BLOCK extrinsics;
+  P_BLOCK target_pose;
+  P_BLOCK pnt_pos;
+  int camera_id;
+  int target_id = -1;
+  bool target_is_moving = false;
+  /*ROS_INFO_STREAM("static camera extrinsics: "<<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[0]<<" "
+                           <<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[1]<<" "
+                           <<ceres_blocks_.static_cameras_.at(0)->camera_parameters_.angle_axis[2]);*/
+
+  // for each camera in scene
+  if (!observation_store_.beginScene(ceres_blocks_.getSceneIndex(scene_id)))
+  {
+    ROS_ERROR_STREAM("Scene id "<<scene_id<<" was observed twice");
+    return false;
+  }
+  for (size_t i = 0; i < acquisition.cameras.size(); i++)
+  {
+    const shared_ptr<Camera> &camera = acquisition.cameras[i];
+    if (camera->isMoving())
+    {
+      // next line does nothing if camera already exist in blocks
+      ceres_blocks_.addMovingCamera(camera, scene_id);
+      camera_id = camera->camera_id_;
+      intrinsics = ceres_blocks_.getMovingCameraParameterBlockIntrinsics(camera_id);
+      extrinsics = ceres_blocks_.getMovingCameraParameterBlockExtrinsics(camera_id, scene_id);
+    }
+    else
+    {
+      // next line does nothing if camera already exist in blocks
+      ceres_blocks_.addStaticCamera(camera);
+      camera_id = camera->camera_id_;
+      intrinsics = ceres_blocks_.getStaticCameraParameterBlockIntrinsics(camera_id);
+      extrinsics = ceres_blocks_.getStaticCameraParameterBlockExtrinsics(camera_id);
+    }
 
-      ROS_DEBUG_STREAM("Processing " << camera_observations.observations.size()
-                           <<" Observations");
-      BOOST_FOREACH(Observation observation, camera_observations.observations)
+    ObservationSpan observations(acquisition.observations[i]);
+    ROS_DEBUG_STREAM("Processing " << observations.size() <<" Observations");
+    for (const Observation *it = observations.begin(); it != observations.end(); ++it)
+    {
+      const Observation &observation = *it;
+      // observations of one target arrive together, so its blocks are only added and looked up once
+      if (observation.target_index != target_id)
       {
-        target_name = observation.target->target_name;
-        int pnt_id = observation.point_id;
-        double observation_x = observation.image_loc_x;
-        double observation_y = observation.image_loc_y;
-        if (observation.target->is_moving)
+        if (observation.target_index < 0 || static_cast<size_t>(observation.target_index) >= target_table_.size()
+            || !target_table_[observation.target_index])
+        {
+          ROS_ERROR_STREAM("Camera "<<camera->camera_name_<<" observed target "<<observation.target_index
+                           <<" which no observation command of scene "<<scene_id<<" holds");
+          // a scene is stored completely or not at all
+          observation_store_.discardScene();
+          return false;
+        }
+        target_id = observation.target_index;
+        const shared_ptr<Target> &target = target_table_[target_id];
+        target_is_moving = target->is_moving;
+        if (target_is_moving)
         {
-          ceres_blocks_.addMovingTarget(observation.target, scene_id);
-          target_pose = ceres_blocks_.getMovingTargetPoseParameterBlock(target_name, scene_id);
-          pnt_pos = ceres_blocks_.getMovingTargetPointParameterBlock(target_name, pnt_id);
+          ceres_blocks_.addMovingTarget(target, scene_id);
+          target_pose = ceres_blocks_.getMovingTargetPoseParameterBlock(target_id, scene_id);
         }
         else
         {
-          ceres_blocks_.addStaticTarget(observation.target); // if exist, does nothing
-          target_pose = ceres_blocks_.getStaticTargetPoseParameterBlock(target_name);
-          pnt_pos = ceres_blocks_.getStaticTargetPointParameterBlock(target_name, pnt_id);
+          ceres_blocks_.addStaticTarget(target); // if exist, does nothing
+          target_pose = ceres_blocks_.getStaticTargetPoseParameterBlock(target_id);
         }
-        ObservationDataPoint temp_ODP(camera_name, target_name, scene_id, intrinsics, extrinsics, pnt_id, target_pose,
-                                      pnt_pos, observation_x, observation_y);
-        listpercamera.addObservationPoint(temp_ODP);
-      }//end for each observed point
-    }//end for each camera
-    observation_data_point_list_.push_back(listpercamera);
-  } //end for each scene
+      }
+      int pnt_id = observation.point_id;
+      double observation_x = observation.image_loc_x;
+      double observation_y = observation.image_loc_y;
+      if (target_is_moving)
+      {
+        pnt_pos = ceres_blocks_.getMovingTargetPointParameterBlock(target_id, pnt_id);
+      }
+      else
+      {
+        pnt_pos = ceres_blocks_.getStaticTargetPointParameterBlock(target_id, pnt_id);
+      }
+      observation_store_.addObservation(camera_id, target_id, scene_id, pnt_id, intrinsics, extrinsics, target_pose,
+                                        pnt_pos, observation_x, observation_y);
+    }//end for each observed point
+  }//end for each camera
   return true;
 }
 
@@ -517,85 +910,769 @@ bool CalibrationJob::runOptimization()
   // take all the data collected and create a Ceres optimization problem and run it
   ROS_INFO_STREAM("Running Optimization...");
   ROS_DEBUG_STREAM("Optimizing "<<scene_list_.size()<<" scenes");
-      BOOST_FOREACH(ObservationScene current_scene, scene_list_)
-      {
+  num_solves_ = 0;
+  num_pruned_ = 0;
+  schur_ordered_ = false;
+  build_time_ = 0.0;
+  solve_time_ = 0.0;
+  component_problems_.clear();
+  block_problems_.clear();
+  extrinsics_.clear();
+  target_pose_.clear();
+  solver_monitor_.start();
+  // set once, the component workers only read the planner
+  solver_planner_.setMaxThreads(std::max(1, num_threads_));
+
+  bool rtn;
+  switch (optimization_mode_)
+  {
+    case optimization_modes::PerSceneSolve:
+      rtn = runPerSceneOptimization();
+      break;
+    case optimization_modes::SingleSolve:
+      rtn = runSingleOptimization();
+      break;
+    case optimization_modes::ComponentSolve:
+      rtn = runComponentOptimization();
+      break;
+    default:
+      ROS_ERROR_STREAM("optimization_mode_ does not correlate to a known optimization mode");
+      return false;
+  }
+  int num_residual_blocks = problem_->NumResidualBlocks();
+  BOOST_FOREACH(const shared_ptr<ceres::Problem> &component_problem, component_problems_)
+  {
+    num_residual_blocks += component_problem->NumResidualBlocks();
+  }
+  has_solution_ = rtn;
+  if (rtn)
+  {
+    ceres_blocks_.storeParameters(); // the cameras and targets hold the results from here on
+  }
+  ROS_INFO_STREAM("Optimization ran "<<num_solves_<<" solve(s) on "<<num_residual_blocks
+                  <<" residual blocks, build time: "<<build_time_<<"s solve time: "<<solve_time_<<"s");
+  if (prune_outliers_)
+  {
+    ROS_INFO_STREAM("Removed "<<num_pruned_<<" outlier observations before the final solve");
+  }
+  ROS_DEBUG_STREAM("Solver monitor recorded "<<solver_monitor_.getRecords().size()<<" iterations");
+  if (solver_monitor_.budgetExceeded())
+  {
+    ROS_WARN_STREAM("Optimization stopped early by the solver time budget");
+  }
+  return rtn;
+}//end runOptimization
+
+void CalibrationJob::configureSolverOptions(ceres::Solver::Options &options,
+                                            SolverMonitor::SolveCallback &monitor_callback)
+{
+  // Make Ceres automatically detect the bundle structure. Note that the
+  // standard solver, SPARSE_NORMAL_CHOLESKY, also works fine but it is slower
+  // for standard bundle adjustment problems.
+  options.linear_solver_type = ceres::DENSE_SCHUR;
+  options.minimizer_progress_to_stdout = false;
+  options.max_num_iterations = 1000;
+  options.callbacks.push_back(&monitor_callback);
+}
+
+bool CalibrationJob::planSolverOptions(ceres::Problem &problem, const std::vector<int> &observations,
+                                       bool auto_tune, int max_threads, ceres::Solver::Options &options)
+{
+  std::set<P_BLOCK> extrinsics;
+  std::set<P_BLOCK> problem_blocks;
+  BOOST_FOREACH(int row, observations)
+  {
+    extrinsics.insert(observation_store_.extrinsics(row));
+    problem_blocks.insert(observation_store_.extrinsics(row));
+    problem_blocks.insert(observation_store_.targetPose(row));
+  }
+
+  // the ordering sorts the blocks of the problem into their kinds, which is the structure the planner needs,
+  // only the free blocks are counted, so the target poses only count when they are estimated
+  ceres::ParameterBlockOrdering ordering;
+  bool ordered = ceres_blocks_.buildSchurOrdering(problem_blocks, ordering) == problem_blocks.size();
+  ProblemStructure structure;
+  structure.num_camera_blocks = 0;
+  structure.num_target_pose_blocks = 0;
+  structure.num_point_blocks = 0;
+  structure.num_residual_blocks = problem.NumResidualBlocks();
+  BOOST_FOREACH(P_BLOCK block, problem_blocks)
+  {
+    if (!problem.HasParameterBlock(block) || problem.IsParameterBlockConstant(block))
+    {
+      continue;
+    }
+    int group = ordered ? ordering.GroupId(block)
+        : (extrinsics.count(block) ? schur_groups::Extrinsics : schur_groups::TargetPoses);
+    switch (group)
+    {
+      case schur_groups::Points:
+        structure.num_point_blocks++;
+        break;
+      case schur_groups::TargetPoses:
+        structure.num_target_pose_blocks++;
+        break;
+      default:
+        structure.num_camera_blocks++;
+        break;
+    }
+  }
+
+  if (auto_tune)
+  {
+    solver_planner_.autoTune(problem, structure, ordered ? &ordering : NULL, caljob_def_file_name_, options);
+  }
+  else
+  {
+    solver_planner_.plan(structure, options);
+  }
+  options.num_threads = std::max(1, std::min(options.num_threads, max_threads));
+
+  // eliminate the many small blocks first instead of letting ceres search for an independent set
+  if (ordered)
+  {
+    return SolverPlanner::attachOrdering(ordering, options);
+  }
+  if (options.linear_solver_type == ceres::DENSE_SCHUR || options.linear_solver_type == ceres::SPARSE_SCHUR
+      || options.linear_solver_type == ceres::ITERATIVE_SCHUR)
+  {
+    ROS_WARN_STREAM("Problem holds blocks outside of ceres_blocks_, using the automatic Schur ordering");
+  }
+  return false;
+}
+
+bool CalibrationJob::runPerSceneOptimization()
+{
+  // a fresh problem, the blocks of a previous run were released with the observations
+  problem_.reset(new ceres::Problem());
+
+  BOOST_FOREACH(ObservationScene &current_scene, scene_list_)
+  {
     int scene_id = current_scene.get_id();
+    int scene_index = ceres_blocks_.getSceneRegistry().find(scene_id);
+    if (scene_index < 0 || scene_index >= observation_store_.numScenes())
+    {
+      ROS_ERROR_STREAM("No observations were stored for scene "<<scene_id);
+      return false;
+    }
+    int scene_begin = observation_store_.sceneBegin(scene_index);
+    int scene_end = observation_store_.sceneEnd(scene_index);
+    ROS_DEBUG_STREAM("Current observation data point list size: "<<scene_end - scene_begin);
+    if (scene_begin == scene_end)
+    {
+      ROS_WARN_STREAM("Scene "<<scene_id<<" has no observations, skipping it");
+      continue;
+    }
 
     //ROS_DEBUG_STREAM("Optimizing # cameras: "<<current_scene.cameras_in_scene_);
 
-    BOOST_FOREACH(shared_ptr<Camera> camera, current_scene.cameras_in_scene_)
-    {
-
-    ROS_DEBUG_STREAM("Current observation data point list size: "<<observation_data_point_list_.at(scene_id).items.size());
-    // take all the data collected and create a Ceres optimization problem and run it
-    P_BLOCK extrinsics;
-    P_BLOCK target_pose;
-    BOOST_FOREACH(ObservationDataPoint ODP, observation_data_point_list_.at(scene_id).items)
-    {
-      // create cost function
-      // there are several options
-      // 1. the complete reprojection error cost function "Create(obs_x,obs_y)"
-      //    this cost function has the following parameters:
-      //      a. camera intrinsics
-      //      b. camera extrinsics
-      //      c. target pose
-      //      d. point location in target frame
-      // 2. the same as 1, but without d  "Create(obs_x,obs_y,t_pnt_x, t_pnt_y, t_pnt_z)
-      // 3. the same as 1, but without a  "Create(obs_x,obs_y,fx,fy,cx,cy,cz)"
-      //    Note that this one assumes we are using rectified images to compute the observations
-      // 4. the same as 3, point location fixed too "Create(obs_x,obs_y,fx,fy,cx,cy,cz,t_x,t_y,t_z)"
-      //        implemented in TargetCameraReprjErrorNoDistortion
-      // 5. the same as 4, but with target in known location
-      //    "Create(obs_x,obs_y,fx,fy,cx,cy,cz,t_x,t_y,t_z,p_tx,p_ty,p_tz,p_ax,p_ay,p_az)"
-
-
-      // pull out the constants from the observation point data
-      double focal_length_x = ODP.camera_intrinsics_[0]; // TODO, make this not so ugly
-      double focal_length_y = ODP.camera_intrinsics_[1];
-      double center_pnt_x   = ODP.camera_intrinsics_[2];
-      double center_pnt_y   = ODP.camera_intrinsics_[3];
-      double image_x        = ODP.image_x_;
-      double image_y        = ODP.image_y_;
-      double point_x        = ODP.point_position_[0];// location of point within target frame
-      double point_y        = ODP.point_position_[1];
-      double point_z        = ODP.point_position_[2];
-
-      // create the cost function
-      CostFunction* cost_function = TargetCameraReprjErrorNoDistortion::Create(image_x, image_y,
-                                                                               focal_length_x,
-                                                                               focal_length_y,
-                                                                               center_pnt_x,
-                                                                               center_pnt_y,
-                                                                               point_x,
-                                                                               point_y,
-                                                                               point_z);
-
-      // pull out pointers to the parameter blocks in the observation point data
-      extrinsics    = ODP.camera_extrinsics_;
-      target_pose   = ODP.target_pose_;
-
-      // add it as a residual using parameter blocks
-      problem_.AddResidualBlock(cost_function, NULL , extrinsics, target_pose);
-    }//for each observation
-      problem_.SetParameterBlockConstant(target_pose);
-    // Make Ceres automatically detect the bundle structure. Note that the
-    // standard solver, SPARSE_NORMAL_CHOLESKY, also works fine but it is slower
-    // for standard bundle adjustment problems.
+    BOOST_FOREACH(const shared_ptr<Camera> &camera, current_scene.cameras_in_scene_)
+    {
+      // take all the data collected and create a Ceres optimization problem and run it
+      P_BLOCK extrinsics = NULL;
+      P_BLOCK target_pose = NULL;
+      ros::WallTime build_start = ros::WallTime::now();
+      for (int row = scene_begin; row < scene_end; row++)
+      {
+        addObservationResidual(*problem_, row);
+        block_problems_[observation_store_.extrinsics(row)] = problem_.get();
+        block_problems_[observation_store_.targetPose(row)] = problem_.get();
+
+        // pull out pointers to the parameter blocks in the observation point data
+        extrinsics = observation_store_.extrinsics(row);
+        target_pose = observation_store_.targetPose(row);
+      }//for each observation
+      problem_->SetParameterBlockConstant(target_pose);
+      build_time_ += (ros::WallTime::now() - build_start).toSec();
+      ceres::Solver::Options options;
+      SolverMonitor::SolveCallback monitor_callback(solver_monitor_, true);
+      configureSolverOptions(options, monitor_callback);
+
+      ceres::Solver::Summary summary;
+      ros::WallTime solve_start = ros::WallTime::now();
+      ceres::Solve(options, problem_.get(), &summary);
+      solve_time_ += (ros::WallTime::now() - solve_start).toSec();
+      num_solves_++;
+      extrinsics_.push_back(extrinsics);
+      target_pose_.push_back(target_pose);
+      if (!summary.IsSolutionUsable())
+      {
+        ROS_ERROR_STREAM("Solve of scene "<<scene_id<<" failed: "<<summary.BriefReport());
+        return false;
+      }
+    }//for each camera
+  }//for each scene
+  return true;
+}//end runPerSceneOptimization
+
+bool CalibrationJob::runSingleOptimization()
+{
+  // a fresh problem, so repeated runs never accumulate duplicate residual blocks
+  problem_.reset(new ceres::Problem());
+
+  ros::WallTime build_start = ros::WallTime::now();
+  std::vector<int> &observations = observation_rows_; // reused, so a repeated run does not reallocate it
+  observations.resize(observation_store_.size());
+  for (int row = 0; row < observations.size(); row++)
+  {
+    observations[row] = row;
+  }
+  if (prune_outliers_)
+  {
+    ros::WallTime prune_start = ros::WallTime::now();
+    num_pruned_ = pruneOutliers(observations, std::max(1, num_threads_));
+    solve_time_ += (ros::WallTime::now() - prune_start).toSec();
+    build_start = ros::WallTime::now();
+  }
+  addObservationResiduals(*problem_, observations);
+  build_time_ = (ros::WallTime::now() - build_start).toSec();
+  mapBlocksToProblem(observations, problem_.get());
+
+  if (problem_->NumResidualBlocks() == 0)
+  {
+    ROS_ERROR_STREAM("No observations were collected, nothing to optimize");
+    return false;
+  }
+
+  // tuning trials are solves too, they count as solve time
+  ros::WallTime solve_start = ros::WallTime::now();
+  ceres::Solver::Options options;
+  SolverMonitor::SolveCallback monitor_callback(solver_monitor_, true);
+  configureSolverOptions(options, monitor_callback);
+  schur_ordered_ = planSolverOptions(*problem_, observations, auto_tune_solver_, std::max(1, num_threads_), options);
+  linear_solver_type_ = options.linear_solver_type;
+
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, problem_.get(), &summary);
+  solve_time_ += (ros::WallTime::now() - solve_start).toSec();
+  num_solves_ = 1;
+  ROS_DEBUG_STREAM(summary.BriefReport());
+
+  extractResults();
+  if (!summary.IsSolutionUsable())
+  {
+    ROS_ERROR_STREAM("Solve failed: "<<summary.BriefReport());
+    return false;
+  }
+  return true;
+}//end runSingleOptimization
+
+bool CalibrationJob::runComponentOptimization()
+{
+  problem_.reset(new ceres::Problem());
+
+  std::vector<ProblemComponent> components;
+  partitionObservations(components);
+  if (components.empty())
+  {
+    ROS_ERROR_STREAM("No observations were collected, nothing to optimize");
+    return false;
+  }
+
+  int num_threads = std::max(1, std::min(num_threads_, static_cast<int>(components.size())));
+  ROS_DEBUG_STREAM("Solving "<<components.size()<<" independent components on "<<num_threads<<" threads");
+
+  // each component owns a disjoint set of parameter blocks, so the solvers write their
+  // results straight into ceres_blocks_ without any further merging
+  size_t next_component = 0;
+  ros::WallTime solve_start = ros::WallTime::now();
+  boost::thread_group workers;
+  for (int i = 0; i < num_threads; i++)
+  {
+    workers.create_thread(boost::bind(&CalibrationJob::solveComponents, this, &components, &next_component));
+  }
+  workers.join_all();
+  solve_time_ = (ros::WallTime::now() - solve_start).toSec();
+
+  bool rtn = true;
+  BOOST_FOREACH(const ProblemComponent &component, components)
+  {
+    if (!component.solved)
+    {
+      ROS_ERROR_STREAM("Solve of a component with "<<component.observations.size()<<" observations failed");
+      rtn = false;
+    }
+    build_time_ += component.build_time;
+    num_pruned_ += component.num_pruned;
+    component_problems_.push_back(component.problem);
+    mapBlocksToProblem(component.observations, component.problem.get());
+  }
+  num_solves_ = components.size();
+
+  extractResults();
+  return rtn;
+}//end runComponentOptimization
+
+void CalibrationJob::mapBlocksToProblem(const std::vector<int> &observations, ceres::Problem *problem)
+{
+  BOOST_FOREACH(int row, observations)
+  {
+    block_problems_[observation_store_.extrinsics(row)] = problem;
+    block_problems_[observation_store_.targetPose(row)] = problem;
+  }
+}
+
+bool CalibrationJob::computeCovariance(const std::vector<P_BLOCK> &blocks,
+                                       std::vector<std::vector<double> > &covariances)
+{
+  ros::WallTime start = ros::WallTime::now();
+  covariances.assign(blocks.size(), std::vector<double>(36, 0.0));
+
+  // only the diagonal blocks of the requested poses are computed, grouped by the problem that estimated them
+  std::map<ceres::Problem*, std::set<const double*> > problem_blocks;
+  BOOST_FOREACH(P_BLOCK block, blocks)
+  {
+    std::map<P_BLOCK, ceres::Problem*>::const_iterator it = block_problems_.find(block);
+    if (it == block_problems_.end())
+    {
+      ROS_WARN_STREAM("Covariance requested for a parameter block which was not optimized");
+      continue;
+    }
+    problem_blocks[it->second].insert(block);
+  }
+
+  bool rtn = true;
+  std::map<ceres::Problem*, std::set<const double*> >::const_iterator pb;
+  for (pb = problem_blocks.begin(); pb != problem_blocks.end(); ++pb)
+  {
+    std::vector<std::pair<const double*, const double*> > covariance_blocks;
+    BOOST_FOREACH(const double *block, pb->second)
+    {
+      covariance_blocks.push_back(std::make_pair(block, block));
+    }
+    ceres::Covariance::Options options;
+    options.algorithm_type = ceres::SPARSE_QR;
+    options.num_threads = std::max(1, num_threads_);
+    ceres::Covariance covariance(options);
+    if (!covariance.Compute(covariance_blocks, pb->first))
+    {
+      ROS_ERROR_STREAM("Covariance computation failed, the problem is rank deficient");
+      rtn = false;
+      continue;
+    }
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+      if (pb->second.count(blocks[i]))
+      {
+        covariance.GetCovarianceBlock(blocks[i], blocks[i], &covariances[i][0]);
+      }
+    }
+  }
+  covariance_time_ = (ros::WallTime::now() - start).toSec();
+  ROS_INFO_STREAM("Computed the covariance of "<<blocks.size()<<" blocks in "<<covariance_time_<<"s");
+  return rtn;
+}
+
+bool CalibrationJob::computeResultCovariance()
+{
+  if (!estimate_target_poses_)
+  {
+    // the target poses are constant in every problem, only the camera extrinsics have a covariance
+    target_pose_covariance_.assign(target_pose_.size(), std::vector<double>(36, 0.0));
+    return computeCovariance(extrinsics_, extrinsics_covariance_);
+  }
+
+  // one computation for both kinds of blocks, the anchored poses are constant and get zeros
+  std::vector<P_BLOCK> blocks(extrinsics_);
+  blocks.insert(blocks.end(), target_pose_.begin(), target_pose_.end());
+  std::vector<std::vector<double> > covariances;
+  bool rtn = computeCovariance(blocks, covariances);
+  extrinsics_covariance_.assign(covariances.begin(), covariances.begin() + extrinsics_.size());
+  target_pose_covariance_.assign(covariances.begin() + extrinsics_.size(), covariances.end());
+  return rtn;
+}
+
+void CalibrationJob::partitionObservations(std::vector<ProblemComponent> &components)
+{
+  // union-find over the block indexes of the camera extrinsics and the free target poses, a constant target pose
+  // does not couple the cameras which observe it, so many cameras seeing one fixed target are solved apart
+  std::vector<int> parent(observation_store_.numBlocks());
+  for (int i = 0; i < parent.size(); i++)
+  {
+    parent[i] = i;
+  }
+  for (int row = 0; row < observation_store_.size(); row++)
+  {
+    if (!isEstimatedTargetPose(row))
+    {
+      continue;
+    }
+    int roots[2] = { observation_store_.extrinsicsIndex(row), observation_store_.targetPoseIndex(row) };
+    for (int i = 0; i < 2; i++)
+    {
+      while (parent[roots[i]] != roots[i])
+      {
+        parent[roots[i]] = parent[parent[roots[i]]];
+        roots[i] = parent[roots[i]];
+      }
+    }
+    parent[roots[1]] = roots[0];
+  }
+
+  // assign every observation to the component of its root block, counting them first
+  // so each component's rows are allocated once
+  std::vector<int> component_index(parent.size(), -1);
+  std::vector<int> row_component(observation_store_.size());
+  std::vector<size_t> component_sizes;
+  for (int row = 0; row < observation_store_.size(); row++)
+  {
+    int root = observation_store_.extrinsicsIndex(row);
+    while (parent[root] != root)
+    {
+      root = parent[root];
+    }
+    if (component_index[root] < 0)
+    {
+      component_index[root] = component_sizes.size();
+      component_sizes.push_back(0);
+    }
+    row_component[row] = component_index[root];
+    component_sizes[row_component[row]]++;
+  }
+  components.resize(component_sizes.size());
+  for (size_t i = 0; i < components.size(); i++)
+  {
+    components[i].build_time = 0.0;
+    components[i].solve_time = 0.0;
+    components[i].solved = false;
+    components[i].observations.reserve(component_sizes[i]);
+  }
+  for (int row = 0; row < observation_store_.size(); row++)
+  {
+    components[row_component[row]].observations.push_back(row);
+  }
+}
+
+void CalibrationJob::solveComponents(std::vector<ProblemComponent> *components, size_t *next_component)
+{
+  while (true)
+  {
+    size_t i;
+    {
+      boost::mutex::scoped_lock lock(component_mutex_);
+      if (*next_component >= components->size())
+      {
+        return;
+      }
+      i = (*next_component)++;
+    }
+    ProblemComponent &component = components->at(i);
+
+    component.solve_time = 0.0;
+    component.num_pruned = 0;
+    if (prune_outliers_)
+    {
+      ros::WallTime prune_start = ros::WallTime::now();
+      component.num_pruned = pruneOutliers(component.observations, 1);
+      component.solve_time = (ros::WallTime::now() - prune_start).toSec();
+    }
+
+    ros::WallTime build_start = ros::WallTime::now();
+    component.problem = boost::make_shared<ceres::Problem>();
+    addObservationResiduals(*component.problem, component.observations);
+    component.build_time = (ros::WallTime::now() - build_start).toSec();
+
     ceres::Solver::Options options;
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    options.minimizer_progress_to_stdout = false;
-    options.max_num_iterations = 1000;
+    SolverMonitor::SolveCallback monitor_callback(solver_monitor_, true);
+    configureSolverOptions(options, monitor_callback);
+    // the other components already occupy the remaining threads
+    planSolverOptions(*component.problem, component.observations, false, 1, options);
 
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem_, &summary);
-    extrinsics_.push_back(extrinsics);
-    target_pose_.push_back(target_pose);
+    ros::WallTime solve_start = ros::WallTime::now();
+    ceres::Solve(options, component.problem.get(), &summary);
+    component.solve_time += (ros::WallTime::now() - solve_start).toSec();
+    component.solved = summary.IsSolutionUsable();
+    ROS_DEBUG_STREAM("Component "<<i<<" with "<<component.observations.size()<<" observations: "
+                     <<summary.BriefReport());
+  }
+}
+
+size_t CalibrationJob::pruneOutliers(std::vector<int> &observations, int max_threads)
+{
+  // a short solve under a robust loss, so a few corrupted detections cannot drag the poses far
+  ceres::Problem robust_problem;
+  addObservationResiduals(robust_problem, observations, outlier_threshold_);
+  if (robust_problem.NumResidualBlocks() == 0)
+  {
+    return 0;
+  }
+  // the outliers are scored at the estimate this solve reaches, so neither the time budget nor the relative
+  // improvement stop may end it early, its iterations are still recorded under a solve id of their own
+  ceres::Solver::Options options;
+  SolverMonitor::SolveCallback monitor_callback(solver_monitor_, false);
+  configureSolverOptions(options, monitor_callback);
+  planSolverOptions(robust_problem, observations, false, max_threads, options);
+  options.max_num_iterations = 50;
+  ceres::Solver::Summary summary;
+  ceres::Solve(options, &robust_problem, &summary);
+  ROS_DEBUG_STREAM("Robust solve: "<<summary.BriefReport());
 
-    //return true;
+  // score every observation by its reprojection error at the robust estimate
+  std::vector<char> is_outlier(observations.size(), 0);
+  std::map<ViewKey, std::pair<int, int> > view_outliers; // outliers and points in each view
+  for (size_t i = 0; i < observations.size(); i++)
+  {
+    int row = observations[i];
+    const double *intrinsics = observation_store_.intrinsics(row);
+    const double *point = observation_store_.pointPosition(row);
+    const double *parameters[2] = { observation_store_.extrinsics(row), observation_store_.targetPose(row) };
+    double residual[2];
+    if (estimate_target_poses_)
+    {
+      TargetPoseCameraReprjErrorNoDistortion cost(observation_store_.imageX(row), observation_store_.imageY(row),
+                                                  intrinsics[0], intrinsics[1], intrinsics[2], intrinsics[3],
+                                                  point[0], point[1], point[2]);
+      cost(parameters[0], parameters[1], residual);
+    }
+    else
+    {
+      TargetCameraReprjErrorNoDistortionAnalytic cost(observation_store_.imageX(row), observation_store_.imageY(row),
+                                                      intrinsics[0], intrinsics[1], intrinsics[2], intrinsics[3],
+                                                      point[0], point[1], point[2]);
+      cost.Evaluate(parameters, residual, NULL);
+    }
+    is_outlier[i] = (residual[0] * residual[0] + residual[1] * residual[1] >
+                     outlier_threshold_ * outlier_threshold_);
+
+    std::pair<int, int> &counts = view_outliers[viewKey(row)];
+    counts.first += is_outlier[i];
+    counts.second++;
+  }
+
+  // a view whose points mostly miss was detected with an inconsistent ordering (e.g. flipped corners),
+  // none of its points can be trusted
+  int num_bad_views = 0;
+  std::map<ViewKey, std::pair<int, int> >::const_iterator view;
+  for (view = view_outliers.begin(); view != view_outliers.end(); ++view)
+  {
+    num_bad_views += (2 * view->second.first > view->second.second);
+  }
+
+  size_t num_kept = 0;
+  for (size_t i = 0; i < observations.size(); i++)
+  {
+    const std::pair<int, int> &counts = view_outliers[viewKey(observations[i])];
+    if (!is_outlier[i] && 2 * counts.first <= counts.second)
+    {
+      observations[num_kept++] = observations[i];
+    }
+  }
+  size_t num_pruned = observations.size() - num_kept;
+  observations.resize(num_kept);
+  ROS_INFO_STREAM("Pruned "<<num_pruned<<" observations above "<<outlier_threshold_<<" pixels, including "
+                  <<num_bad_views<<" inconsistent views");
+  return num_pruned;
+}
+
+void CalibrationJob::addObservationResiduals(ceres::Problem &problem, const std::vector<int> &observations,
+                                             double loss_scale)
+{
+  // a robust loss has to see each point on its own, so it always uses one block per point,
+  // as do the estimated target poses, the batched views ignore the target pose
+  if (use_batched_residuals_ && loss_scale <= 0.0 && !estimate_target_poses_)
+  {
+    // one block per view
+    std::map<ViewKey, int> view_index;
+    std::vector<TargetCameraReprjErrorNoDistortionBatch*> views;
+    std::vector<int> view_rows; // first observation of each view, holds its blocks
+    BOOST_FOREACH(int row, observations)
+    {
+      std::map<ViewKey, int>::iterator it = view_index.find(viewKey(row));
+      if (it == view_index.end())
+      {
+        const double *intrinsics = observation_store_.intrinsics(row);
+        it = view_index.insert(std::make_pair(viewKey(row), static_cast<int>(views.size()))).first;
+        views.push_back(new TargetCameraReprjErrorNoDistortionBatch(intrinsics[0], intrinsics[1], intrinsics[2],
+                                                                    intrinsics[3]));
+        view_rows.push_back(row);
+      }
+      const double *point = observation_store_.pointPosition(row);
+      views[it->second]->addPoint(observation_store_.imageX(row), observation_store_.imageY(row), point[0], point[1],
+                                  point[2]);
+    }
+    for (int i = 0; i < views.size(); i++)
+    {
+      // ceres rejects a block without residuals
+      if (views[i]->numPoints() == 0)
+      {
+        ROS_ERROR_STREAM("Skipping a view without points of observation "<<view_rows[i]);
+        delete views[i];
+        continue;
+      }
+      problem.AddResidualBlock(views[i], NULL, observation_store_.extrinsics(view_rows[i]),
+                               observation_store_.targetPose(view_rows[i]));
+    }
+  }
+  else
+  {
+    BOOST_FOREACH(int row, observations)
+    {
+      addObservationResidual(problem, row, loss_scale);
+    }
+  }
+
+  // target points are expressed in the target frame, the target poses are not adjusted unless the moving target
+  // poses are estimated, then the first pose of each moving target in the problem anchors the frame
+  std::vector<P_BLOCK> anchor_poses; // by target id, only filled when the poses are estimated
+  BOOST_FOREACH(int row, observations)
+  {
+    P_BLOCK target_pose = observation_store_.targetPose(row);
+    if (isEstimatedTargetPose(row))
+    {
+      int target_id = observation_store_.targetId(row);
+      if (target_id >= static_cast<int>(anchor_poses.size()))
+      {
+        anchor_poses.resize(target_id + 1, NULL);
+      }
+      if (anchor_poses[target_id] == NULL)
+      {
+        anchor_poses[target_id] = target_pose;
+      }
+      if (anchor_poses[target_id] != target_pose)
+      {
+        continue;
+      }
+    }
+    problem.SetParameterBlockConstant(target_pose);
+  }
+}
+
+bool CalibrationJob::isEstimatedTargetPose(int row)
+{
+  // the pose block of a moving target is its pose in the scene of the observation
+  return estimate_target_poses_
+      && ceres_blocks_.getMovingTargetPoseParameterBlock(observation_store_.targetId(row),
+                                                         observation_store_.sceneId(row))
+          == observation_store_.targetPose(row);
+}
+
+void CalibrationJob::addObservationResidual(ceres::Problem &problem, int row, double loss_scale)
+{
+  // create cost function
+  // there are several options
+  // 1. the complete reprojection error cost function "Create(obs_x,obs_y)"
+  //    this cost function has the following parameters:
+  //      a. camera intrinsics
+  //      b. camera extrinsics
+  //      c. target pose
+  //      d. point location in target frame
+  // 2. the same as 1, but without d  "Create(obs_x,obs_y,t_pnt_x, t_pnt_y, t_pnt_z)
+  // 3. the same as 1, but without a  "Create(obs_x,obs_y,fx,fy,cx,cy,cz)"
+  //    Note that this one assumes we are using rectified images to compute the observations
+  // 4. the same as 3, point location fixed too "Create(obs_x,obs_y,fx,fy,cx,cy,cz,t_x,t_y,t_z)"
+  //        implemented in TargetCameraReprjErrorNoDistortion
+  // 5. the same as 4, but with target in known location
+  //    "Create(obs_x,obs_y,fx,fy,cx,cy,cz,t_x,t_y,t_z,p_tx,p_ty,p_tz,p_ax,p_ay,p_az)"
+
+
+  // pull out the constants from the observation point data
+  const double *intrinsics = observation_store_.intrinsics(row);
+  const double *point_position = observation_store_.pointPosition(row);
+  double focal_length_x = intrinsics[0]; // TODO, make this not so ugly
+  double focal_length_y = intrinsics[1];
+  double center_pnt_x   = intrinsics[2];
+  double center_pnt_y   = intrinsics[3];
+  double image_x        = observation_store_.imageX(row);
+  double image_y        = observation_store_.imageY(row);
+  double point_x        = point_position[0];// location of point within target frame
+  double point_y        = point_position[1];
+  double point_z        = point_position[2];
+
+  // create the cost function
+  CostFunction* cost_function;
+  if (estimate_target_poses_)
+  {
+    // the other costs take the points in the target frame as world points, the target pose has no effect on them
+    cost_function = TargetPoseCameraReprjErrorNoDistortion::Create(image_x, image_y,
+                                                                   focal_length_x,
+                                                                   focal_length_y,
+                                                                   center_pnt_x,
+                                                                   center_pnt_y,
+                                                                   point_x,
+                                                                   point_y,
+                                                                   point_z);
+  }
+  else if (use_analytic_jacobians_)
+  {
+    cost_function = TargetCameraReprjErrorNoDistortionAnalytic::Create(image_x, image_y,
+                                                                       focal_length_x,
+                                                                       focal_length_y,
+                                                                       center_pnt_x,
+                                                                       center_pnt_y,
+                                                                       point_x,
+                                                                       point_y,
+                                                                       point_z);
+  }
+  else
+  {
+    cost_function = TargetCameraReprjErrorNoDistortion::Create(image_x, image_y,
+                                                               focal_length_x,
+                                                               focal_length_y,
+                                                               center_pnt_x,
+                                                               center_pnt_y,
+                                                               point_x,
+                                                               point_y,
+                                                               point_z);
+  }
+
+  // add it as a residual using parameter blocks
+  ceres::LossFunction *loss_function = NULL;
+  if (loss_scale > 0.0)
+  {
+    loss_function = new ceres::CauchyLoss(loss_scale);
+  }
+  problem.AddResidualBlock(cost_function, loss_function, observation_store_.extrinsics(row),
+                           observation_store_.targetPose(row));
+}
+
+ViewKey CalibrationJob::viewKey(int row) const
+{
+  return ViewKey(std::make_pair(observation_store_.extrinsicsIndex(row), observation_store_.targetPoseIndex(row)),
+                 observation_store_.sceneId(row));
+}
+
+void CalibrationJob::extractResults()
+{
+  // one entry per camera in each scene, in the same order as the per scene solve
+  BOOST_FOREACH(ObservationScene &current_scene, scene_list_)
+  {
+    int scene_id = current_scene.get_id();
+    BOOST_FOREACH(const shared_ptr<Camera> &camera, current_scene.cameras_in_scene_)
+    {
+      P_BLOCK extrinsics;
+      if (camera->isMoving())
+      {
+        extrinsics = ceres_blocks_.getMovingCameraParameterBlockExtrinsics(camera->camera_id_, scene_id);
+      }
+      else
+      {
+        extrinsics = ceres_blocks_.getStaticCameraParameterBlockExtrinsics(camera->camera_id_);
+      }
+
+      // the target pose comes from the first target this camera was commanded to observe
+      P_BLOCK target_pose = NULL;
+      BOOST_FOREACH(const ObservationCmd &o_command, current_scene.observation_command_list_)
+      {
+        if (o_command.camera->camera_id_ != camera->camera_id_)
+        {
+          continue;
+        }
+        if (o_command.target->is_moving)
+        {
+          target_pose = ceres_blocks_.getMovingTargetPoseParameterBlock(o_command.target->target_id, scene_id);
+        }
+        else
+        {
+          target_pose = ceres_blocks_.getStaticTargetPoseParameterBlock(o_command.target->target_id);
+        }
+        break;
+      }
+      extrinsics_.push_back(extrinsics);
+      target_pose_.push_back(target_pose);
     }//for each camera
   }//for each scene
-  return true;
-}//end runOptimization
+}
 
 bool CalibrationJob::store()
 {
@@ -17,12 +17,21 @@
  */
 
 #include <industrial_extrinsic_cal/runtime_utils.h>
+#include <industrial_extrinsic_cal/CalibrationCovariance.h>
 #include <std_srvs/Empty.h>
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <boost/make_shared.hpp>
+#include <std_msgs/Float64MultiArray.h>
 
 bool calibrated=false;
+boost::shared_ptr<industrial_extrinsic_cal::CalibrationJob> cal_job; // kept between calls to warm start recalibrations
+ros::Publisher progress_pub;
+bool publish_progress=false;
 bool callback(std_srvs::Empty::Request& request, std_srvs::Empty::Response& response);
+bool covarianceCallback(industrial_extrinsic_cal::CalibrationCovariance::Request& request,
+                        industrial_extrinsic_cal::CalibrationCovariance::Response& response);
+void configureSolver(ros::NodeHandle& priv_nh);
 std::vector<tf::Transform> b_transforms;
 
 int main(int argc, char **argv)
@@ -31,26 +40,37 @@ int main(int argc, char **argv)
 
   ros::NodeHandle nh;
   ros::ServiceServer service=nh.advertiseService("calibration_service", callback);
+  ros::ServiceServer covariance_service=nh.advertiseService("calibration_covariance", covarianceCallback);
   industrial_extrinsic_cal::ROSRuntimeUtils utils;
   ros::NodeHandle priv_nh_("~");
 
+  priv_nh_.getParam("publish_solver_progress", publish_progress);
+  if (publish_progress)
+  {
+    progress_pub = nh.advertise<std_msgs::Float64MultiArray>("calibration_progress", 100);
+  }
   priv_nh_.getParam("camera_file", utils.camera_file_);
   priv_nh_.getParam("target_file", utils.target_file_);
   priv_nh_.getParam("cal_job_file", utils.caljob_file_);
   std::string path = ros::package::getPath("industrial_extrinsic_cal");
   std::string file_path=path+"/yaml/";
-  industrial_extrinsic_cal::CalibrationJob cal_job(file_path+utils.camera_file_, file_path+utils.target_file_, file_path+utils.caljob_file_);
+  std::string solver_cache_file;
+  if (priv_nh_.getParam("solver_cache_file", solver_cache_file))
+  {
+    industrial_extrinsic_cal::SolverPlanner::loadCache(file_path+solver_cache_file);
+  }
+  industrial_extrinsic_cal::CalibrationJob initial_job(file_path+utils.camera_file_, file_path+utils.target_file_, file_path+utils.caljob_file_);
 
-  if (cal_job.load())
+  if (initial_job.load())
   {
     ROS_INFO_STREAM("Calibration job (cal_job, target and camera) yaml parameters loaded.");
   }
 
-  utils.world_frame_=cal_job.getReferenceFrame();
-  utils.camera_optical_frame_=cal_job.getCameraOpticalFrame();
-  utils.camera_intermediate_frame_=cal_job.getCameraIntermediateFrame();
-  utils.initial_extrinsics_ = cal_job.getOriginalExtrinsics();
-  utils.target_frame_=cal_job.getTargetFrames();
+  utils.world_frame_=initial_job.getReferenceFrame();
+  utils.camera_optical_frame_=initial_job.getCameraOpticalFrame();
+  utils.camera_intermediate_frame_=initial_job.getCameraIntermediateFrame();
+  utils.initial_extrinsics_ = initial_job.getOriginalExtrinsics();
+  utils.target_frame_=initial_job.getTargetFrames();
   industrial_extrinsic_cal::P_BLOCK orig_extrinsics;
   tf::Transform tf_camera_orig;
   for (int k=0; k<utils.initial_extrinsics_.size(); k++ )
@@ -127,19 +147,47 @@ bool callback(std_srvs::Empty::Request& request, std_srvs::Empty::Response& resp
   priv_nh_.getParam("store_results_file_name", launch_file_name);
   std::string path = ros::package::getPath("industrial_extrinsic_cal");
   std::string file_path=path+"/yaml/";
-  industrial_extrinsic_cal::CalibrationJob cal_job(file_path+utils.camera_file_, file_path+utils.target_file_, file_path+utils.caljob_file_);
+  bool warm_start=false;
+  std::string recal_job_file;
+  priv_nh_.getParam("warm_start", warm_start);
 
-  cal_job.load();
-  utils.world_frame_=cal_job.getReferenceFrame();
-  utils.camera_optical_frame_=cal_job.getCameraOpticalFrame();
-  utils.camera_intermediate_frame_=cal_job.getCameraIntermediateFrame();
-  utils.target_frame_=cal_job.getTargetFrames();
-  if (cal_job.run())
+  bool job_complete;
+  if (warm_start && cal_job && cal_job->hasSolution())
+  {
+    // keep the solved parameter blocks and observations, collect only the scenes of the recalibration job
+    if (priv_nh_.getParam("recalibration_cal_job_file", recal_job_file)
+        && !cal_job->appendScenes(file_path+recal_job_file))
+    {
+      ROS_ERROR_STREAM("Recalibration job "<<recal_job_file<<" could not be appended, nothing was recalibrated");
+      return false;
+    }
+    configureSolver(priv_nh_);
+    job_complete = cal_job->runIncremental();
+  }
+  else
+  {
+    cal_job = boost::make_shared<industrial_extrinsic_cal::CalibrationJob>(file_path+utils.camera_file_,
+                                                                            file_path+utils.target_file_,
+                                                                            file_path+utils.caljob_file_);
+    cal_job->load();
+    configureSolver(priv_nh_);
+    job_complete = cal_job->run();
+  }
+  utils.world_frame_=cal_job->getReferenceFrame();
+  utils.camera_optical_frame_=cal_job->getCameraOpticalFrame();
+  utils.camera_intermediate_frame_=cal_job->getCameraIntermediateFrame();
+  utils.target_frame_=cal_job->getTargetFrames();
+  if (job_complete)
   {
     ROS_INFO_STREAM("Calibration job observations and optimization complete");
   }
-  utils.calibrated_extrinsics_ = cal_job.getExtrinsics();
-  utils.target_poses_ = cal_job.getTargetPose();
+  std::string solver_cache_file;
+  if (priv_nh_.getParam("solver_cache_file", solver_cache_file))
+  {
+    industrial_extrinsic_cal::SolverPlanner::saveCache(file_path+solver_cache_file);
+  }
+  utils.calibrated_extrinsics_ = cal_job->getExtrinsics();
+  utils.target_poses_ = cal_job->getTargetPose();
   ROS_DEBUG_STREAM("Size of optimized_extrinsics_: "<<utils.calibrated_extrinsics_.size());
   ROS_DEBUG_STREAM("Size of targets_: "<<utils.target_poses_.size());
 
@@ -200,7 +248,7 @@ bool callback(std_srvs::Empty::Request& request, std_srvs::Empty::Response& resp
   b_transforms=utils.calibrated_transforms_;
   calibrated=true;
 
-  if (cal_job.store())
+  if (cal_job->store())
   {
     ROS_INFO_STREAM("Calibration job optimization camera results saved");
   }
@@ -216,3 +264,55 @@ bool callback(std_srvs::Empty::Request& request, std_srvs::Empty::Response& resp
 
   return true;
 }
+
+bool covarianceCallback(industrial_extrinsic_cal::CalibrationCovariance::Request& request,
+                        industrial_extrinsic_cal::CalibrationCovariance::Response& response)
+{
+  // the covariance is only computed on request, it can cost as much as the calibration itself
+  if (!cal_job || !cal_job->hasSolution())
+  {
+    ROS_ERROR_STREAM("No calibration has been solved, call calibration_service first");
+    return false;
+  }
+  if (!cal_job->computeResultCovariance())
+  {
+    ROS_ERROR_STREAM("Covariance of the optimized poses could not be computed");
+    return false;
+  }
+  ROS_INFO_STREAM("Covariance of the optimized poses computed in "<<cal_job->getCovarianceTime()<<"s");
+  BOOST_FOREACH(const std::vector<double> &covariance, cal_job->getExtrinsicsCovariance())
+  {
+    response.extrinsics_covariance.insert(response.extrinsics_covariance.end(), covariance.begin(), covariance.end());
+  }
+  BOOST_FOREACH(const std::vector<double> &covariance, cal_job->getTargetPoseCovariance())
+  {
+    response.target_pose_covariance.insert(response.target_pose_covariance.end(), covariance.begin(),
+                                           covariance.end());
+  }
+  response.covariance_time = cal_job->getCovarianceTime();
+  return true;
+}
+
+void configureSolver(ros::NodeHandle& priv_nh)
+{
+  double time_budget=0.0;
+  double min_relative_improvement=0.0;
+  bool auto_tune=false;
+  double camera_timeout=10.0;
+  int pipeline_depth=2;
+  priv_nh.getParam("solver_time_budget", time_budget);
+  priv_nh.getParam("min_relative_improvement", min_relative_improvement);
+  priv_nh.getParam("auto_tune_solver", auto_tune);
+  cal_job->setAutoTuneSolver(auto_tune);
+  priv_nh.getParam("camera_timeout", camera_timeout);
+  cal_job->setCameraTimeout(camera_timeout);
+  priv_nh.getParam("pipeline_depth", pipeline_depth);
+  cal_job->setPipelineDepth(std::max(1, pipeline_depth));
+  industrial_extrinsic_cal::SolverMonitor& monitor = cal_job->getSolverMonitor();
+  monitor.setTimeBudget(time_budget);
+  monitor.setMinRelativeImprovement(min_relative_improvement);
+  if (publish_progress)
+  {
+    monitor.setPublisher(progress_pub);
+  }
+}
@@ -29,11 +29,12 @@ using ceres::CostFunction;
 Camera::Camera()
 {
   camera_name_ = "NONE";
+  camera_id_ = -1;
   is_moving_ = false;
 }
 
 Camera::Camera(string name, CameraParameters camera_parameters, bool is_moving) :
-    camera_name_(name), camera_parameters_(camera_parameters), is_moving_(is_moving),
+    camera_name_(name), camera_id_(-1), camera_parameters_(camera_parameters), is_moving_(is_moving),
     fixed_intrinsics_(true), fixed_extrinsics_(false)
 {
 }
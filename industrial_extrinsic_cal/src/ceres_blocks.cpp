@@ -19,6 +19,7 @@
 
 #include <industrial_extrinsic_cal/ceres_blocks.h>
 #include <boost/shared_ptr.hpp>
+#include <algorithm>
 
 using std::string;
 using boost::shared_ptr;
@@ -34,230 +35,359 @@ CeresBlocks::~CeresBlocks()
 }
 void CeresBlocks::clearCamerasTargets()
 {
-  //ROS_INFO_STREAM("Attempting to clear cameras and targets from ceresBlocks");
   static_targets_.clear();
-  //ROS_INFO_STREAM("Moving Targets "<<moving_targets_.size());
-  moving_targets_.clear();
-  //ROS_INFO_STREAM("Static cameras "<<static_cameras_.size());
   static_cameras_.clear();
-  //ROS_INFO_STREAM("Moving cameras "<<moving_cameras_.size());
-  moving_cameras_.clear();
-  //ROS_INFO_STREAM("Cameras and Targets cleared from CeresBlocks");
+  static_camera_index_.clear();
+  moving_camera_index_.clear();
+  static_target_index_.clear();
+  moving_target_index_.clear();
+  arena_.clear(); // releases every parameter block at once
 }
-P_BLOCK CeresBlocks::getStaticCameraParameterBlockIntrinsics(string camera_name)
+void CeresBlocks::storeParameters()
 {
-  // static cameras should have unique name
-  BOOST_FOREACH(shared_ptr<Camera> camera, static_cameras_)
+  typedef boost::unordered_map<int, CameraBlocks>::value_type StaticCameraEntry;
+  typedef boost::unordered_map<int, MovingCameraBlocks>::value_type MovingCameraEntry;
+  typedef boost::unordered_map<int, TargetBlocks>::value_type StaticTargetEntry;
+  typedef boost::unordered_map<int, MovingTargetBlocks>::value_type MovingTargetEntry;
+  BOOST_FOREACH(const StaticCameraEntry &entry, static_camera_index_)
+  {
+    std::copy(entry.second.extrinsics, entry.second.extrinsics + 15, entry.second.cam->camera_parameters_.pb_all);
+  }
+  // a moving camera object only has room for one pose, it gets the pose of its latest scene
+  BOOST_FOREACH(const MovingCameraEntry &entry, moving_camera_index_)
   {
-    if (camera_name == camera->camera_name_)
+    const MovingCameraBlocks &blocks = entry.second;
+    std::copy(blocks.last_extrinsics, blocks.last_extrinsics + 6, blocks.cam->camera_parameters_.pb_extrinsics);
+    std::copy(blocks.intrinsics, blocks.intrinsics + 9, blocks.cam->camera_parameters_.pb_intrinsics);
+  }
+  BOOST_FOREACH(const StaticTargetEntry &entry, static_target_index_)
+  {
+    const TargetBlocks &blocks = entry.second;
+    std::copy(blocks.pose, blocks.pose + 6, blocks.targ->pose.pb_pose);
+    for (int i = 0; i < blocks.targ->pts.size(); i++)
     {
-      P_BLOCK intrinsics = &(camera->camera_parameters_.pb_intrinsics[0]);
-      return (intrinsics);
+      std::copy(blocks.points + 3 * i, blocks.points + 3 * i + 3, blocks.targ->pts[i].pb);
     }
   }
-  return (NULL);
+  // a moving target's points never change, its object gets the pose of its latest scene
+  BOOST_FOREACH(const MovingTargetEntry &entry, moving_target_index_)
+  {
+    std::copy(entry.second.last_pose, entry.second.last_pose + 6, entry.second.targ->pose.pb_pose);
+  }
+}
+CameraBlocks CeresBlocks::allocateCameraBlocks(shared_ptr<Camera> camera)
+{
+  // extrinsics and intrinsics are kept adjacent, in the same order as CameraParameters::pb_all
+  CameraBlocks blocks;
+  blocks.cam = camera;
+  blocks.extrinsics = arena_.allocate(15, camera->camera_parameters_.pb_all);
+  blocks.intrinsics = blocks.extrinsics + 6;
+  return blocks;
 }
-P_BLOCK CeresBlocks::getMovingCameraParameterBlockIntrinsics(string camera_name)
+P_BLOCK CeresBlocks::allocatePoints(const Target &target)
 {
-  // we use the intrinsic parameters from the first time the camera appears in the list
-  // subsequent cameras with this name also have intrinsic parameters, but these are
-  // never used as parameter blocks, only their extrinsics are used
-  BOOST_FOREACH(shared_ptr<MovingCamera> moving_camera, moving_cameras_)
+  P_BLOCK points = arena_.allocate(3 * target.pts.size());
+  for (int i = 0; i < target.pts.size(); i++)
   {
-    if (camera_name == moving_camera->cam->camera_name_)
-    {
-      P_BLOCK intrinsics = &(moving_camera->cam->camera_parameters_.pb_intrinsics[0]);
-      return (intrinsics);
-    }
+    std::copy(target.pts[i].pb, target.pts[i].pb + 3, points + 3 * i);
   }
-  return (NULL);
+  return points;
+}
+int CeresBlocks::getNameId(const string &name)
+{
+  return names_.intern(name);
+}
+const NameTable& CeresBlocks::getNameTable() const
+{
+  return names_;
+}
+int CeresBlocks::getSceneIndex(int scene_id)
+{
+  return scenes_.add(scene_id);
+}
+const SceneRegistry& CeresBlocks::getSceneRegistry() const
+{
+  return scenes_;
+}
+P_BLOCK CeresBlocks::getStaticCameraParameterBlockIntrinsics(const string &camera_name)
+{
+  return getStaticCameraParameterBlockIntrinsics(names_.find(camera_name));
+}
+P_BLOCK CeresBlocks::getMovingCameraParameterBlockIntrinsics(const string &camera_name)
+{
+  return getMovingCameraParameterBlockIntrinsics(names_.find(camera_name));
+}
+P_BLOCK CeresBlocks::getStaticCameraParameterBlockExtrinsics(const string &camera_name)
+{
+  return getStaticCameraParameterBlockExtrinsics(names_.find(camera_name));
+}
+P_BLOCK CeresBlocks::getMovingCameraParameterBlockExtrinsics(const string &camera_name, int scene_id)
+{
+  return getMovingCameraParameterBlockExtrinsics(names_.find(camera_name), scene_id);
+}
+P_BLOCK CeresBlocks::getStaticTargetPoseParameterBlock(const string &target_name)
+{
+  return getStaticTargetPoseParameterBlock(names_.find(target_name));
+}
+P_BLOCK CeresBlocks::getStaticTargetPointParameterBlock(const string &target_name, int point_id)
+{
+  return getStaticTargetPointParameterBlock(names_.find(target_name), point_id);
+}
+P_BLOCK CeresBlocks::getMovingTargetPoseParameterBlock(const string &target_name, int scene_id)
+{
+  return getMovingTargetPoseParameterBlock(names_.find(target_name), scene_id);
 }
-P_BLOCK CeresBlocks::getStaticCameraParameterBlockExtrinsics(string camera_name)
+P_BLOCK CeresBlocks::getMovingTargetPointParameterBlock(const string &target_name, int pnt_id)
+{
+  return getMovingTargetPointParameterBlock(names_.find(target_name), pnt_id);
+}
+P_BLOCK CeresBlocks::getStaticCameraParameterBlockIntrinsics(int camera_id)
 {
   // static cameras should have unique name
-  BOOST_FOREACH(shared_ptr<Camera> camera, static_cameras_)
+  boost::unordered_map<int, CameraBlocks>::const_iterator it = static_camera_index_.find(camera_id);
+  if (it == static_camera_index_.end())
   {
-    if (camera_name == camera->camera_name_)
-    {
-      P_BLOCK extrinsics = &(camera->camera_parameters_.pb_extrinsics[0]);
-      return (extrinsics);
-    }
+    return (NULL);
   }
-  return (NULL);
-
+  return it->second.intrinsics;
 }
-P_BLOCK CeresBlocks::getMovingCameraParameterBlockExtrinsics(string camera_name, int scene_id)
+P_BLOCK CeresBlocks::getMovingCameraParameterBlockIntrinsics(int camera_id)
 {
-  BOOST_FOREACH(shared_ptr<MovingCamera> camera, moving_cameras_)
+  boost::unordered_map<int, MovingCameraBlocks>::const_iterator it = moving_camera_index_.find(camera_id);
+  if (it == moving_camera_index_.end())
   {
-    if (camera_name == camera->cam->camera_name_ && scene_id == camera->scene_id)
-    {
-      P_BLOCK extrinsics = &(camera->cam->camera_parameters_.pb_extrinsics[0]);
-      return (extrinsics);
-    }
+    return (NULL);
   }
-  return (NULL);
-
+  return it->second.intrinsics;
 }
-P_BLOCK CeresBlocks::getStaticTargetPoseParameterBlock(string target_name)
+P_BLOCK CeresBlocks::getStaticCameraParameterBlockExtrinsics(int camera_id)
 {
-  BOOST_FOREACH(shared_ptr<Target> target, static_targets_)
+  // static cameras should have unique name
+  boost::unordered_map<int, CameraBlocks>::const_iterator it = static_camera_index_.find(camera_id);
+  if (it == static_camera_index_.end())
   {
-    if (target_name == target->target_name)
-    {
-      P_BLOCK pose = &(target->pose.pb_pose[0]);
-      return (pose);
-    }
+    return (NULL);
   }
-  return (NULL);
+  return it->second.extrinsics;
 }
-P_BLOCK CeresBlocks::getStaticTargetPointParameterBlock(string target_name, int point_id)
+P_BLOCK CeresBlocks::getMovingCameraParameterBlockExtrinsics(int camera_id, int scene_id)
 {
-  BOOST_FOREACH(shared_ptr<Target> target, static_targets_)
+  boost::unordered_map<int, MovingCameraBlocks>::const_iterator it = moving_camera_index_.find(camera_id);
+  int scene_index = scenes_.find(scene_id);
+  if (it == moving_camera_index_.end() || scene_index < 0 || scene_index >= it->second.extrinsics.size())
   {
-    if (target_name == target->target_name)
-    {
-      P_BLOCK point_position = &(target->pts[point_id].pb[0]);
-      return (point_position);
-    }
+    return (NULL);
   }
-  return (NULL);
+  return it->second.extrinsics[scene_index];
 }
-P_BLOCK CeresBlocks::getMovingTargetPoseParameterBlock(string target_name, int scene_id)
+P_BLOCK CeresBlocks::getStaticTargetPoseParameterBlock(int target_id)
 {
-  BOOST_FOREACH(shared_ptr<MovingTarget> moving_target, moving_targets_)
+  boost::unordered_map<int, TargetBlocks>::const_iterator it = static_target_index_.find(target_id);
+  if (it == static_target_index_.end())
   {
-    if (target_name == moving_target->targ->target_name && scene_id == moving_target->scene_id)
-    {
-      P_BLOCK pose = &(moving_target->targ->pose.pb_pose[0]);
-      return (pose);
-    }
+    return (NULL);
+  }
+  return it->second.pose;
+}
+P_BLOCK CeresBlocks::getStaticTargetPointParameterBlock(int target_id, int point_id)
+{
+  boost::unordered_map<int, TargetBlocks>::const_iterator it = static_target_index_.find(target_id);
+  if (it == static_target_index_.end())
+  {
+    return (NULL);
+  }
+  return it->second.points + 3 * point_id;
+}
+P_BLOCK CeresBlocks::getMovingTargetPoseParameterBlock(int target_id, int scene_id)
+{
+  boost::unordered_map<int, MovingTargetBlocks>::const_iterator it = moving_target_index_.find(target_id);
+  int scene_index = scenes_.find(scene_id);
+  if (it == moving_target_index_.end() || scene_index < 0 || scene_index >= it->second.poses.size())
+  {
+    return (NULL);
   }
-  return (NULL);
+  return it->second.poses[scene_index];
 }
-P_BLOCK CeresBlocks::getMovingTargetPointParameterBlock(string target_name, int pnt_id)
+P_BLOCK CeresBlocks::getMovingTargetPointParameterBlock(int target_id, int pnt_id)
 {
   // note scene_id unnecessary here since regarless of scene th point's location relative to
   // the target frame does not change
-  BOOST_FOREACH(shared_ptr<MovingTarget> moving_target, moving_targets_)
+  boost::unordered_map<int, MovingTargetBlocks>::const_iterator it = moving_target_index_.find(target_id);
+  if (it == moving_target_index_.end())
   {
-    if (target_name == moving_target->targ->target_name)
-    {
-      P_BLOCK point_position = &(moving_target->targ->pts[pnt_id].pb[0]);
-      return (point_position);
-    }
+    return (NULL);
   }
-  return (NULL);
+  return it->second.points + 3 * pnt_id;
 }
 
 bool CeresBlocks::addStaticCamera(shared_ptr<Camera> camera_to_add)
 {
-  BOOST_FOREACH(shared_ptr<Camera> cam, static_cameras_)
+  camera_to_add->camera_id_ = names_.intern(camera_to_add->camera_name_);
+  if (static_camera_index_.count(camera_to_add->camera_id_))
   {
-    if (cam->camera_name_ == camera_to_add->camera_name_)
-      return (false); // camera already exists
+    return (false); // camera already exists
   }
+  static_camera_index_[camera_to_add->camera_id_] = allocateCameraBlocks(camera_to_add);
   static_cameras_.push_back(camera_to_add);
-  //ROS_INFO_STREAM("Camera added to static_cameras_");
   return (true);
 }
 bool CeresBlocks::addStaticTarget(shared_ptr<Target> target_to_add)
 {
-  BOOST_FOREACH(shared_ptr<Target> targ, static_targets_)
+  int target_id = names_.intern(target_to_add->target_name);
+  if (static_target_index_.count(target_id))
   {
-    if (targ->target_name == target_to_add->target_name)
-      return (false); // target already exists
+    return (false); // target already exists
   }
+  TargetBlocks blocks;
+  blocks.targ = target_to_add;
+  blocks.pose = arena_.allocate(6, target_to_add->pose.pb_pose);
+  blocks.points = allocatePoints(*target_to_add);
+  static_target_index_[target_id] = blocks;
   static_targets_.push_back(target_to_add);
   return (true);
 }
 bool CeresBlocks::addMovingCamera(shared_ptr<Camera> camera_to_add, int scene_id)
 {
-  BOOST_FOREACH(shared_ptr<MovingCamera> cam, moving_cameras_)
+  camera_to_add->camera_id_ = names_.intern(camera_to_add->camera_name_);
+  int scene_index = scenes_.add(scene_id);
+  // the first scene of a camera allocates the intrinsics shared by all of its scenes
+  boost::unordered_map<int, MovingCameraBlocks>::iterator it = moving_camera_index_.find(camera_to_add->camera_id_);
+  if (it == moving_camera_index_.end())
   {
-    if (cam->cam->camera_name_ == camera_to_add->camera_name_ && cam->scene_id == scene_id)
-      return (false); // camera already exists
+    MovingCameraBlocks blocks;
+    blocks.cam = camera_to_add;
+    blocks.intrinsics = arena_.allocate(9, camera_to_add->camera_parameters_.pb_intrinsics);
+    it = moving_camera_index_.insert(std::make_pair(camera_to_add->camera_id_, blocks)).first;
   }
-  // this next line allocates the memory for a moving camera
-  shared_ptr<MovingCamera> temp_moving_camera = boost::make_shared<MovingCamera>();
-  // this next line allocates the memory for the actual camera
-  shared_ptr<Camera> temp_camera = boost::make_shared<Camera>(camera_to_add->camera_name_, camera_to_add->camera_parameters_,
-                                                       true);
-  temp_moving_camera->cam = temp_camera;
-  temp_moving_camera->scene_id = scene_id;
-  moving_cameras_.push_back(temp_moving_camera);
+  std::vector<P_BLOCK> &extrinsics = it->second.extrinsics;
+  if (scene_index < extrinsics.size() && extrinsics[scene_index] != NULL)
+  {
+    return (false); // camera already exists
+  }
+  if (scene_index >= extrinsics.size())
+  {
+    extrinsics.resize(scene_index + 1, NULL);
+  }
+  // each scene only adds a pose, consecutive scenes get adjacent blocks in the arena
+  extrinsics[scene_index] = arena_.allocate(6, camera_to_add->camera_parameters_.pb_extrinsics);
+  it->second.last_extrinsics = extrinsics[scene_index];
   return (true);
 }
 bool CeresBlocks::addMovingTarget(shared_ptr<Target> target_to_add, int scene_id)
 {
-  BOOST_FOREACH(shared_ptr<MovingTarget> targ, moving_targets_)
+  int target_id = names_.intern(target_to_add->target_name);
+  int scene_index = scenes_.add(scene_id);
+  // the first scene of a target copies the point table shared by all of its scenes
+  boost::unordered_map<int, MovingTargetBlocks>::iterator it = moving_target_index_.find(target_id);
+  if (it == moving_target_index_.end())
+  {
+    MovingTargetBlocks blocks;
+    blocks.targ = target_to_add;
+    blocks.points = allocatePoints(*target_to_add);
+    it = moving_target_index_.insert(std::make_pair(target_id, blocks)).first;
+  }
+  std::vector<P_BLOCK> &poses = it->second.poses;
+  if (scene_index < poses.size() && poses[scene_index] != NULL)
+  {
+    return (false); // target already exists
+  }
+  if (scene_index >= poses.size())
   {
-    if (targ->targ->target_name == target_to_add->target_name && targ->scene_id == scene_id)
-      return (false); // target already exists
+    poses.resize(scene_index + 1, NULL);
   }
-  shared_ptr<MovingTarget> temp_moving_target = boost::make_shared<MovingTarget>();
-  shared_ptr<Target> temp_camera = boost::make_shared<Target>();
-  temp_moving_target->targ = target_to_add;
-  temp_moving_target->scene_id = scene_id;
-  moving_targets_.push_back(temp_moving_target);
+  // each scene only adds a pose
+  poses[scene_index] = arena_.allocate(6, target_to_add->pose.pb_pose);
+  it->second.last_pose = poses[scene_index];
   return (true);
 }
 
-const boost::shared_ptr<Camera> CeresBlocks::getCameraByName(const std::string &camera_name)
+int CeresBlocks::buildSchurOrdering(const std::set<P_BLOCK> &problem_blocks, ceres::ParameterBlockOrdering &ordering)
 {
-  boost::shared_ptr<Camera> cam = boost::make_shared<Camera>();
-  //ROS_INFO_STREAM("Found "<<static_cameras_.size() <<" static cameras");
-  for (int i=0; i< static_cameras_.size() ; i++ )
+  typedef boost::unordered_map<int, TargetBlocks>::value_type StaticTargetEntry;
+  typedef boost::unordered_map<int, MovingTargetBlocks>::value_type MovingTargetEntry;
+  typedef boost::unordered_map<int, CameraBlocks>::value_type StaticCameraEntry;
+  typedef boost::unordered_map<int, MovingCameraBlocks>::value_type MovingCameraEntry;
+  std::set<P_BLOCK> ordered;
+  std::vector<std::pair<P_BLOCK, int> > blocks;
+  BOOST_FOREACH(const StaticTargetEntry &entry, static_target_index_)
   {
-    if (static_cameras_.at(i)->camera_name_==camera_name)
+    for (int i = 0; i < entry.second.targ->pts.size(); i++)
     {
-      cam= static_cameras_.at(i);
-      ROS_DEBUG_STREAM("Found static camera with name: "<<static_cameras_.at(i)->camera_name_);
+      blocks.push_back(std::make_pair(entry.second.points + 3 * i, static_cast<int>(schur_groups::Points)));
     }
+    blocks.push_back(std::make_pair(entry.second.pose, static_cast<int>(schur_groups::TargetPoses)));
   }
-  //ROS_INFO_STREAM("Found "<<moving_cameras_.size() <<" moving cameras");
-  for (int i=0; i< moving_cameras_.size() ; i++ )
+  BOOST_FOREACH(const MovingTargetEntry &entry, moving_target_index_)
   {
-    if (moving_cameras_.at(i)->cam->camera_name_==camera_name)
+    for (int i = 0; i < entry.second.targ->pts.size(); i++)
+    {
+      blocks.push_back(std::make_pair(entry.second.points + 3 * i, static_cast<int>(schur_groups::Points)));
+    }
+    BOOST_FOREACH(P_BLOCK pose, entry.second.poses)
     {
-      cam= moving_cameras_.at(i)->cam;
-      ROS_DEBUG_STREAM("Found moving camera with name: "<<camera_name);
+      blocks.push_back(std::make_pair(pose, static_cast<int>(schur_groups::TargetPoses)));
     }
   }
-  if (!cam)
+  BOOST_FOREACH(const StaticCameraEntry &entry, static_camera_index_)
   {
-    ROS_ERROR_STREAM("Fail");
+    blocks.push_back(std::make_pair(entry.second.extrinsics, static_cast<int>(schur_groups::Extrinsics)));
+    blocks.push_back(std::make_pair(entry.second.intrinsics, static_cast<int>(schur_groups::Intrinsics)));
   }
-  return cam;
-  //return true;
-}
-
-const boost::shared_ptr<Target> CeresBlocks::getTargetByName(const std::string &target_name)
-{
-  boost::shared_ptr<Target> target = boost::make_shared<Target>();
-  //ROS_INFO_STREAM("Found "<<static_cameras_.size() <<" static cameras");
-  for (int i=0; i< static_targets_.size() ; i++ )
+  BOOST_FOREACH(const MovingCameraEntry &entry, moving_camera_index_)
   {
-    if (static_targets_.at(i)->target_name==target_name)
+    BOOST_FOREACH(P_BLOCK extrinsics, entry.second.extrinsics)
     {
-      target=static_targets_.at(i);
-      ROS_DEBUG_STREAM("Found static target with name: "<<target_name);
+      blocks.push_back(std::make_pair(extrinsics, static_cast<int>(schur_groups::Extrinsics)));
     }
+    blocks.push_back(std::make_pair(entry.second.intrinsics, static_cast<int>(schur_groups::Intrinsics)));
   }
-  //ROS_INFO_STREAM("Found "<<moving_cameras_.size() <<" static cameras");
-  for (int i=0; i< moving_targets_.size() ; i++ )
+
+  for (int i = 0; i < blocks.size(); i++)
   {
-    if (moving_targets_.at(i)->targ->target_name==target_name)
+    if (problem_blocks.count(blocks[i].first) && ordered.insert(blocks[i].first).second)
     {
-      target=moving_targets_.at(i)->targ;
-      ROS_DEBUG_STREAM("Found moving target with name: "<<target_name);
+      ordering.AddElementToGroup(blocks[i].first, blocks[i].second);
     }
   }
-  if (!target)
+  return ordered.size();
+}
+
+const boost::shared_ptr<Camera> CeresBlocks::getCameraByName(const std::string &camera_name)
+{
+  // a moving camera shadows a static one of the same name
+  int camera_id = names_.find(camera_name);
+  boost::unordered_map<int, MovingCameraBlocks>::const_iterator moving = moving_camera_index_.find(camera_id);
+  if (moving != moving_camera_index_.end())
+  {
+    ROS_DEBUG_STREAM("Found moving camera with name: "<<camera_name);
+    return moving->second.cam;
+  }
+  boost::unordered_map<int, CameraBlocks>::const_iterator it = static_camera_index_.find(camera_id);
+  if (it != static_camera_index_.end())
+  {
+    ROS_DEBUG_STREAM("Found static camera with name: "<<camera_name);
+    return it->second.cam;
+  }
+  return boost::make_shared<Camera>();
+}
+
+const boost::shared_ptr<Target> CeresBlocks::getTargetByName(const std::string &target_name)
+{
+  // a moving target shadows a static one of the same name
+  int target_id = names_.find(target_name);
+  boost::unordered_map<int, MovingTargetBlocks>::const_iterator moving = moving_target_index_.find(target_id);
+  if (moving != moving_target_index_.end())
+  {
+    ROS_DEBUG_STREAM("Found moving target with name: "<<target_name);
+    return moving->second.targ;
+  }
+  boost::unordered_map<int, TargetBlocks>::const_iterator it = static_target_index_.find(target_id);
+  if (it != static_target_index_.end())
   {
-    ROS_ERROR_STREAM("Fail");
+    ROS_DEBUG_STREAM("Found static target with name: "<<target_name);
+    return it->second.targ;
   }
-  return target;
+  return boost::make_shared<Target>();
 }
 
 
@@ -3,6 +3,7 @@
 #include "ceres/ceres.h"
 #include "ceres/rotation.h"
 #include <iostream>
+#include <industrial_extrinsic_cal/solver_planner.h>
 typedef struct
 {
   int p_id; // point's id
@@ -408,11 +409,15 @@ int main(int argc, char** argv)
      */
   }
 
-  // Make Ceres automatically detect the bundle structure. Note that the
-  // standard solver, SPARSE_NORMAL_CHOLESKY, also works fine but it is slower
-  // for standard bundle adjustment problems.
+  // one free camera, the intrinsics and points are held constant
+  industrial_extrinsic_cal::ProblemStructure structure;
+  structure.num_camera_blocks = 1;
+  structure.num_target_pose_blocks = 0;
+  structure.num_point_blocks = 0;
+  structure.num_residual_blocks = num_observations;
   ceres::Solver::Options options;
-  options.linear_solver_type = ceres::DENSE_SCHUR;
+  industrial_extrinsic_cal::SolverPlanner planner;
+  planner.plan(structure, options);
   options.minimizer_progress_to_stdout = true;
   options.max_num_iterations = 1000;
 
@@ -0,0 +1,68 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <industrial_extrinsic_cal/name_table.h>
+
+namespace industrial_extrinsic_cal
+{
+
+NameTable::NameTable()
+{
+}
+
+NameTable::~NameTable()
+{
+}
+
+int NameTable::intern(const std::string &name)
+{
+  std::pair<boost::unordered_map<std::string, int>::iterator, bool> result =
+      ids_.insert(std::make_pair(name, static_cast<int>(names_.size())));
+  if (result.second)
+  {
+    names_.push_back(name);
+  }
+  return result.first->second;
+}
+
+int NameTable::find(const std::string &name) const
+{
+  boost::unordered_map<std::string, int>::const_iterator it = ids_.find(name);
+  if (it == ids_.end())
+  {
+    return (-1);
+  }
+  return it->second;
+}
+
+const std::string& NameTable::name(int id) const
+{
+  static const std::string unknown;
+  if (id < 0 || id >= static_cast<int>(names_.size()))
+  {
+    return unknown;
+  }
+  return names_[id];
+}
+
+int NameTable::size() const
+{
+  return static_cast<int>(names_.size());
+}
+
+}//end namespace industrial_extrinsic_cal
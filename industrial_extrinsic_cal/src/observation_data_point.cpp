@@ -17,6 +17,7 @@
  */
 
 #include <industrial_extrinsic_cal/observation_data_point.h>
+#include <algorithm>
 
 namespace industrial_extrinsic_cal
 {
@@ -37,6 +38,159 @@ void ObservationDataPointList::addObservationPoint(ObservationDataPoint new_data
   items.push_back(new_data_point);
 }
 
+ObservationStore::ObservationStore() :
+    current_scene_(-1)
+{
+}
+
+ObservationStore::~ObservationStore()
+{
+}
+
+void ObservationStore::reserve(size_t num_observations)
+{
+  image_x_.reserve(num_observations);
+  image_y_.reserve(num_observations);
+  camera_id_.reserve(num_observations);
+  target_id_.reserve(num_observations);
+  scene_id_.reserve(num_observations);
+  point_id_.reserve(num_observations);
+  intrinsics_.reserve(num_observations);
+  extrinsics_.reserve(num_observations);
+  target_pose_.reserve(num_observations);
+  point_position_.reserve(num_observations);
+  // a row brings at most one new point block, the camera and target blocks are few
+  blocks_.reserve(num_observations);
+}
+
+void ObservationStore::clear()
+{
+  image_x_.clear();
+  image_y_.clear();
+  camera_id_.clear();
+  target_id_.clear();
+  scene_id_.clear();
+  point_id_.clear();
+  intrinsics_.clear();
+  extrinsics_.clear();
+  target_pose_.clear();
+  point_position_.clear();
+  scene_rows_.clear();
+  current_scene_ = -1;
+  blocks_.clear();
+  // the slots are emptied rather than released, so a repeated run of the same job does not allocate
+  std::fill(block_slots_.begin(), block_slots_.end(), std::make_pair(P_BLOCK(NULL), int32_t(-1)));
+}
+
+bool ObservationStore::beginScene(int scene_index)
+{
+  if (scene_index >= static_cast<int>(scene_rows_.size()))
+  {
+    scene_rows_.resize(scene_index + 1, std::make_pair(int32_t(-1), int32_t(-1)));
+  }
+  if (scene_rows_[scene_index].first >= 0)
+  {
+    return false;
+  }
+  scene_rows_[scene_index] = std::make_pair(static_cast<int32_t>(size()), static_cast<int32_t>(size()));
+  current_scene_ = scene_index;
+  return true;
+}
+
+void ObservationStore::discardScene()
+{
+  if (current_scene_ < 0)
+  {
+    return;
+  }
+  // the scene started last holds the last rows
+  size_t begin = scene_rows_[current_scene_].first;
+  image_x_.resize(begin);
+  image_y_.resize(begin);
+  camera_id_.resize(begin);
+  target_id_.resize(begin);
+  scene_id_.resize(begin);
+  point_id_.resize(begin);
+  intrinsics_.resize(begin);
+  extrinsics_.resize(begin);
+  target_pose_.resize(begin);
+  point_position_.resize(begin);
+  scene_rows_[current_scene_] = std::make_pair(int32_t(-1), int32_t(-1));
+  current_scene_ = -1;
+}
+
+int ObservationStore::addObservation(int camera_id, int target_id, int scene_id, int point_id, P_BLOCK intrinsics,
+                                     P_BLOCK extrinsics, P_BLOCK target_pose, P_BLOCK point_position,
+                                     double image_x, double image_y)
+{
+  if (current_scene_ < 0)
+  {
+    beginScene(0);
+  }
+  image_x_.push_back(image_x);
+  image_y_.push_back(image_y);
+  camera_id_.push_back(camera_id);
+  target_id_.push_back(target_id);
+  scene_id_.push_back(scene_id);
+  point_id_.push_back(point_id);
+  intrinsics_.push_back(blockIndex(intrinsics));
+  extrinsics_.push_back(blockIndex(extrinsics));
+  target_pose_.push_back(blockIndex(target_pose));
+  point_position_.push_back(blockIndex(point_position));
+  scene_rows_[current_scene_].second = size();
+  return size() - 1;
+}
+
+ObservationDataPoint ObservationStore::getObservationPoint(int row) const
+{
+  return ObservationDataPoint(cameraId(row), targetId(row), sceneId(row), intrinsics(row), extrinsics(row),
+                              pointId(row), targetPose(row), pointPosition(row), imageX(row), imageY(row));
+}
+
+// blocks are arena addresses, so the low bits carry no information
+static size_t hashBlock(P_BLOCK block)
+{
+  return (reinterpret_cast<size_t>(block) >> 3) * 2654435761u;
+}
+
+int32_t ObservationStore::blockIndex(P_BLOCK block)
+{
+  // linear probing, the table is kept at most half full
+  if (2 * (blocks_.size() + 1) > block_slots_.size())
+  {
+    growBlockSlots();
+  }
+  size_t mask = block_slots_.size() - 1;
+  size_t slot = hashBlock(block) & mask;
+  while (block_slots_[slot].second >= 0)
+  {
+    if (block_slots_[slot].first == block)
+    {
+      return block_slots_[slot].second;
+    }
+    slot = (slot + 1) & mask;
+  }
+  block_slots_[slot] = std::make_pair(block, static_cast<int32_t>(blocks_.size()));
+  blocks_.push_back(block);
+  return block_slots_[slot].second;
+}
+
+void ObservationStore::growBlockSlots()
+{
+  block_slots_.assign(std::max(static_cast<size_t>(64), 2 * block_slots_.size()),
+                      std::make_pair(P_BLOCK(NULL), int32_t(-1)));
+  size_t mask = block_slots_.size() - 1;
+  for (size_t i = 0; i < blocks_.size(); i++)
+  {
+    size_t slot = hashBlock(blocks_[i]) & mask;
+    while (block_slots_[slot].second >= 0)
+    {
+      slot = (slot + 1) & mask;
+    }
+    block_slots_[slot] = std::make_pair(blocks_[i], static_cast<int32_t>(i));
+  }
+}
+
 }//end namespace industrial_extrinsic_cal
 
 
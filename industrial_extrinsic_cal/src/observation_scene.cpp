@@ -27,13 +27,13 @@ namespace industrial_extrinsic_cal
 {
 
 
-void ObservationScene::addObservationToScene(ObservationCmd new_obs_cmd)
+void ObservationScene::addObservationToScene(const ObservationCmd &new_obs_cmd)
 {
   // this next block of code maintains a list of the cameras in a scene
   bool camera_already_in_scene = false;
-  BOOST_FOREACH(ObservationCmd command, observation_command_list_)
+  BOOST_FOREACH(const ObservationCmd &command, observation_command_list_)
   {
-    BOOST_FOREACH(shared_ptr<Camera> camera, cameras_in_scene_)
+    BOOST_FOREACH(const shared_ptr<Camera> &camera, cameras_in_scene_)
     {
       if (camera->camera_name_ == new_obs_cmd.camera->camera_name_)
       {
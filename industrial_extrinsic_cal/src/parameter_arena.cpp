@@ -0,0 +1,100 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <industrial_extrinsic_cal/parameter_arena.h>
+#include <algorithm>
+#include <cstring>
+
+namespace industrial_extrinsic_cal
+{
+
+// chunks start on a cache line, blocks on a pair of doubles
+static const size_t CHUNK_ALIGNMENT = 64;
+static const size_t BLOCK_ALIGNMENT = 2;
+
+ParameterArena::ParameterArena(size_t chunk_size) :
+    chunk_size_(std::max(chunk_size, BLOCK_ALIGNMENT)), current_chunk_(0), chunk_used_(0), used_(0)
+{
+}
+
+ParameterArena::~ParameterArena()
+{
+  for (size_t i = 0; i < chunks_.size(); i++)
+  {
+    delete[] chunks_[i].storage;
+  }
+}
+
+P_BLOCK ParameterArena::allocate(size_t size, const double *values)
+{
+  size_t padded_size = (size + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+
+  // move past chunks without room, these are only skipped until the next clear()
+  while (current_chunk_ < chunks_.size() && chunk_used_ + padded_size > chunks_[current_chunk_].capacity)
+  {
+    current_chunk_++;
+    chunk_used_ = 0;
+  }
+  if (current_chunk_ == chunks_.size())
+  {
+    Chunk chunk;
+    chunk.capacity = std::max(chunk_size_, padded_size);
+    chunk.storage = new double[chunk.capacity + CHUNK_ALIGNMENT / sizeof(double)];
+    size_t address = reinterpret_cast<size_t>(chunk.storage);
+    chunk.data = reinterpret_cast<double*>((address + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT);
+    chunks_.push_back(chunk);
+    chunk_used_ = 0;
+  }
+
+  P_BLOCK block = chunks_[current_chunk_].data + chunk_used_;
+  chunk_used_ += padded_size;
+  used_ += padded_size;
+  if (values != NULL)
+  {
+    std::copy(values, values + size, block);
+  }
+  else
+  {
+    std::memset(block, 0, size * sizeof(double));
+  }
+  return block;
+}
+
+void ParameterArena::clear()
+{
+  current_chunk_ = 0;
+  chunk_used_ = 0;
+  used_ = 0;
+}
+
+size_t ParameterArena::used() const
+{
+  return used_;
+}
+
+size_t ParameterArena::capacity() const
+{
+  size_t total = 0;
+  for (size_t i = 0; i < chunks_.size(); i++)
+  {
+    total += chunks_[i].capacity;
+  }
+  return total;
+}
+
+}//end namespace industrial_extrinsic_cal
@@ -17,33 +17,160 @@
  */
 
 #include <industrial_extrinsic_cal/ros_camera_observer.h>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/once.hpp>
+#include <algorithm>
+#include <deque>
+#include <set>
 
 namespace industrial_extrinsic_cal
 {
 
+/** @brief threads shared by every observer to detect the targets of an image in parallel,
+ *         so the number of detection threads does not grow with the number of cameras
+ */
+class DetectionPool
+{
+public:
+  /** @brief the pool of the process, its threads are started on first use */
+  static DetectionPool& instance()
+  {
+    boost::call_once(&DetectionPool::create, created_);
+    return *pool_;
+  }
+
+  /** @brief stops the threads and joins them, a thread helping an observer finishes its target first */
+  ~DetectionPool()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+    }
+    queued_.notify_all();
+    threads_.join_all();
+  }
+
+  /** @brief number of threads in the pool */
+  size_t size() const
+  {
+    return size_;
+  }
+
+  /** @brief queues requests for help with the current image of an observer
+   *  @param observer the observer
+   *  @param count number of threads asked to help
+   */
+  void post(ROSCameraObserver *observer, size_t count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.insert(queue_.end(), count, observer);
+    queued_.notify_all();
+  }
+
+  /** @brief removes the queued requests of an observer and waits until none of the threads helps it any longer
+   *  @param observer the observer
+   */
+  void cancel(ROSCameraObserver *observer)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    queue_.erase(std::remove(queue_.begin(), queue_.end(), observer), queue_.end());
+    while (running_.count(observer))
+    {
+      finished_.wait(lock);
+    }
+  }
+
+private:
+  explicit DetectionPool(size_t size) :
+      size_(size), stopping_(false)
+  {
+    for (size_t i = 0; i < size_; i++)
+    {
+      threads_.create_thread(boost::bind(&DetectionPool::work, this));
+    }
+  }
+
+  /** @brief creates the pool, it is destroyed with the other statics when the process exits */
+  static void create()
+  {
+    pool_.reset(new DetectionPool(std::max(1u, boost::thread::hardware_concurrency())));
+  }
+
+  /** @brief loop of every thread */
+  void work()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true)
+    {
+      while (queue_.empty() && !stopping_)
+      {
+        queued_.wait(lock);
+      }
+      // the observers detect the targets nobody helps with themselves, so queued requests may be dropped
+      if (stopping_)
+      {
+        return;
+      }
+      ROSCameraObserver *observer = queue_.front();
+      queue_.pop_front();
+      running_.insert(observer);
+      lock.unlock();
+      observer->helpDetection();
+      lock.lock();
+      running_.erase(running_.find(observer));
+      finished_.notify_all();
+    }
+  }
+
+  static boost::scoped_ptr<DetectionPool> pool_;
+  static boost::once_flag created_;
+  size_t size_; /*!< number of threads */
+  bool stopping_; /*!< the threads return instead of taking the next request */
+  boost::mutex mutex_; /*!< guards queue_, running_ and stopping_ */
+  boost::condition_variable queued_; /*!< signals the threads that queue_ holds requests or that they stop */
+  boost::condition_variable finished_; /*!< signals cancel() that a thread stopped helping an observer */
+  std::deque<ROSCameraObserver*> queue_; /*!< observers asking for help, once for each thread asked */
+  std::multiset<ROSCameraObserver*> running_; /*!< observers being helped, once for each helping thread */
+  boost::thread_group threads_;
+};
+
+boost::scoped_ptr<DetectionPool> DetectionPool::pool_;
+boost::once_flag DetectionPool::created_ = BOOST_ONCE_INIT;
+
 ROSCameraObserver::ROSCameraObserver(const std::string &camera_topic) :
-    sym_circle_(true), pattern_(pattern_options::Chessboard), pattern_rows_(0), pattern_cols_(0)
+    next_request_(0), num_detected_(0)
 {
   image_topic_ = camera_topic;
   //ROS_DEBUG_STREAM("ROSCameraObserver created with image topic: "<<image_topic_);
   results_pub_ = nh_.advertise<sensor_msgs::Image>("observer_results_image", 100);
 }
 
+ROSCameraObserver::~ROSCameraObserver()
+{
+  // the trigger thread uses the members below, the image timeout bounds the wait
+  joinTrigger();
+}
+
 bool ROSCameraObserver::addTarget(boost::shared_ptr<Target> targ, Roi &roi)
 {
   //set pattern based on target
   ROS_INFO_STREAM("Target type: "<<targ->target_type);
-  instance_target_ = targ;
+  TargetRequest request;
+  request.target = targ;
+  request.sym_circle = true;
+  request.in_image = false;
+  request.found = false;
   switch (targ->target_type)
   {
     case pattern_options::Chessboard:
-      pattern_ = pattern_options::Chessboard;
+      request.pattern = pattern_options::Chessboard;
       break;
     case pattern_options::CircleGrid:
-      pattern_ = pattern_options::CircleGrid;
+      request.pattern = pattern_options::CircleGrid;
       break;
     case pattern_options::ARtag:
-      pattern_ = pattern_options::ARtag;
+      request.pattern = pattern_options::ARtag;
       break;
     default:
       ROS_ERROR_STREAM("target_type does not correlate to a known pattern option (Chessboard, CircleGrid or ARTag)");
@@ -51,23 +178,17 @@ bool ROSCameraObserver::addTarget(boost::shared_ptr<Target> targ, Roi &roi)
       break;
   }
 
-  if (pattern_ != 0 && pattern_ != 1 && pattern_ != 2)
-  {
-    ROS_ERROR_STREAM("Unknown pattern, based on target_type");
-    return false;
-  }
-
   //set pattern rows/cols based on target
-  switch (pattern_)
+  switch (request.pattern)
   {
     case pattern_options::Chessboard:
-      pattern_rows_ = targ->checker_board_parameters.pattern_rows;
-      pattern_cols_ = targ->checker_board_parameters.pattern_cols;
+      request.pattern_rows = targ->checker_board_parameters.pattern_rows;
+      request.pattern_cols = targ->checker_board_parameters.pattern_cols;
       break;
     case pattern_options::CircleGrid:
-      pattern_rows_ = targ->circle_grid_parameters.pattern_rows;
-      pattern_cols_ = targ->circle_grid_parameters.pattern_cols;
-      sym_circle_ = targ->circle_grid_parameters.is_symmetric;
+      request.pattern_rows = targ->circle_grid_parameters.pattern_rows;
+      request.pattern_cols = targ->circle_grid_parameters.pattern_cols;
+      request.sym_circle = targ->circle_grid_parameters.is_symmetric;
       break;
     case pattern_options::ARtag:
       ROS_ERROR_STREAM("AR Tag recognized but pattern not supported yet");
@@ -79,18 +200,19 @@ bool ROSCameraObserver::addTarget(boost::shared_ptr<Target> targ, Roi &roi)
       break;
   }
 
-  input_roi_.x=roi.x_min;
-  input_roi_.y= roi.y_min;
-  input_roi_.width= roi.x_max - roi.x_min;
-  input_roi_.height= roi.y_max - roi.y_min;
-  ROS_INFO_STREAM("ROSCameraObserver added target and roi");
+  request.roi.x = roi.x_min;
+  request.roi.y = roi.y_min;
+  request.roi.width = roi.x_max - roi.x_min;
+  request.roi.height = roi.y_max - roi.y_min;
+  requests_.push_back(request);
+  ROS_INFO_STREAM("ROSCameraObserver added target and roi, "<<requests_.size()<<" targets");
 
   return true;
 }
 
 void ROSCameraObserver::clearTargets()
 {
-  instance_target_.reset();
+  requests_.clear();
   //ROS_INFO_STREAM("Targets cleared from observer");
 }
 
@@ -102,80 +224,195 @@ void ROSCameraObserver::clearObservations()
 
 int ROSCameraObserver::getObservations(CameraObservations &cam_obs)
 {
-  bool successful_find = false;
+  if (!findObservations())
+  {
+    return 0;
+  }
+  cam_obs = camera_obs_;
+  return 1;
+}
 
-  ROS_INFO_STREAM("image ROI region created: "<<input_roi_.x<<" "<<input_roi_.y<<" "<<input_roi_.width<<" "<<input_roi_.height);
-  if (input_bridge_->image.cols < input_roi_.width || input_bridge_->image.rows < input_roi_.height)
+int ROSCameraObserver::swapObservations(CameraObservations &cam_obs)
+{
+  if (!findObservations())
   {
-    ROS_ERROR_STREAM("ROI too big for image size");
     return 0;
   }
+  cam_obs.observations.swap(camera_obs_.observations);
+  return 1;
+}
+
+bool ROSCameraObserver::findObservations()
+{
+  if (requests_.empty())
+  {
+    ROS_WARN_STREAM("No targets to find in the image of "<<image_topic_);
+    return false;
+  }
 
-  image_roi_ = input_bridge_->image(input_roi_);
+  cv::Rect image_rect(0, 0, input_bridge_->image.cols, input_bridge_->image.rows);
+  BOOST_FOREACH(TargetRequest &request, requests_)
+  {
+    ROS_INFO_STREAM("image ROI region created: "<<request.roi.x<<" "<<request.roi.y<<" "<<request.roi.width<<" "<<request.roi.height);
+    // a region outside of the image only loses its own target
+    request.in_image = ((request.roi & image_rect) == request.roi);
+    if (!request.in_image)
+    {
+      ROS_ERROR_STREAM("ROI too big for image size, skipping target "<<request.target->target_name);
+      continue;
+    }
+    // the debug image is the only copy of the region, it is skipped when nobody is listening
+    if (results_pub_.getNumSubscribers() > 0)
+    {
+      cv::Mat image_roi = input_bridge_->image(request.roi);
+      ROS_INFO_STREAM("output image size: " <<image_roi.rows<<" x "<<image_roi.cols);
+      results_pub_.publish(cv_bridge::CvImage(input_bridge_->header, input_bridge_->encoding, image_roi).toImageMsg());
+    }
+  }
 
-  output_bridge_->image = output_bridge_->image(input_roi_);
-  out_bridge_->image = image_roi_;
-  ROS_INFO_STREAM("output image size: " <<output_bridge_->image.rows<<" x "<<output_bridge_->image.cols);
-  results_pub_.publish(out_bridge_->toImageMsg());
+  // every target is searched for in the same image, each request is written by a single thread,
+  // a single target is detected here and the others are shared with the pool
+  boost::mutex::scoped_lock lock(request_mutex_);
+  next_request_ = 0;
+  num_detected_ = 0;
+  size_t num_helpers = 0;
+  if (requests_.size() > 1)
+  {
+    DetectionPool &pool = DetectionPool::instance();
+    num_helpers = std::min(pool.size(), requests_.size() - 1);
+    pool.post(this, num_helpers);
+  }
+  detectTargets(lock);
+  while (num_detected_ < requests_.size())
+  {
+    detection_done_.wait(lock);
+  }
+  lock.unlock();
+  if (num_helpers > 0)
+  {
+    // helpers which did not start yet are not needed any more
+    DetectionPool::instance().cancel(this);
+  }
 
-  switch (pattern_)
+  // the observations of each target are kept together, in the order the targets were added
+  size_t num_points = 0;
+  BOOST_FOREACH(const TargetRequest &request, requests_)
+  {
+    if (request.found)
+    {
+      num_points += request.observation_pts.size();
+    }
+  }
+  if (num_points == 0)
+  {
+    return false;
+  }
+  camera_obs_.observations.resize(num_points);
+  size_t row = 0;
+  BOOST_FOREACH(const TargetRequest &request, requests_)
+  {
+    if (!request.found)
+    {
+      continue;
+    }
+    for (int i = 0; i < request.observation_pts.size(); i++, row++)
+    {
+      camera_obs_.observations.at(row).target_index = request.target->target_id;
+      camera_obs_.observations.at(row).point_id = i;
+      camera_obs_.observations.at(row).image_loc_x = request.observation_pts.at(i).x;
+      camera_obs_.observations.at(row).image_loc_y = request.observation_pts.at(i).y;
+    }
+  }
+  return true;
+}
+
+void ROSCameraObserver::detectTargets(boost::mutex::scoped_lock &lock)
+{
+  while (next_request_ < requests_.size())
+  {
+    size_t i = next_request_++;
+    lock.unlock();
+    detectTarget(requests_[i]);
+    lock.lock();
+    if (++num_detected_ == requests_.size())
+    {
+      detection_done_.notify_all();
+    }
+  }
+}
+
+void ROSCameraObserver::helpDetection()
+{
+  boost::mutex::scoped_lock lock(request_mutex_);
+  detectTargets(lock);
+}
+
+void ROSCameraObserver::detectTarget(TargetRequest &request)
+{
+  request.found = false;
+  if (!request.in_image)
+  {
+    return;
+  }
+  // a view of the region, the detectors only read it
+  cv::Mat image_roi = input_bridge_->image(request.roi);
+  cv::Size pattern_size(request.pattern_rows, request.pattern_cols);
+  switch (request.pattern)
   {
     case pattern_options::Chessboard:
       ROS_INFO_STREAM("Finding Chessboard Corners...");
-      successful_find = cv::findChessboardCorners(image_roi_, cv::Size(pattern_rows_, pattern_cols_), observation_pts_,
-                                                  cv::CALIB_CB_ADAPTIVE_THRESH);
+      request.found = cv::findChessboardCorners(image_roi, pattern_size, request.observation_pts,
+                                                cv::CALIB_CB_ADAPTIVE_THRESH);
       break;
     case pattern_options::CircleGrid:
-      if (sym_circle_)
+      if (request.sym_circle)
       {
         ROS_INFO_STREAM("Finding Circles in grid, symmetric...");
-        successful_find = cv::findCirclesGrid(image_roi_, cv::Size(pattern_rows_, pattern_cols_), observation_pts_,
-                                              cv::CALIB_CB_SYMMETRIC_GRID);
+        request.found = cv::findCirclesGrid(image_roi, pattern_size, request.observation_pts,
+                                            cv::CALIB_CB_SYMMETRIC_GRID);
       }
       else
       {
         ROS_INFO_STREAM("Finding Circles in grid, asymmetric...");
-        successful_find = cv::findCirclesGrid(image_roi_, cv::Size(pattern_rows_, pattern_cols_), observation_pts_,
-                                              cv::CALIB_CB_ASYMMETRIC_GRID | cv::CALIB_CB_CLUSTERING);
+        request.found = cv::findCirclesGrid(image_roi, pattern_size, request.observation_pts,
+                                            cv::CALIB_CB_ASYMMETRIC_GRID | cv::CALIB_CB_CLUSTERING);
       }
       break;
   }
-  if (!successful_find)
+  if (!request.found)
   {
-    ROS_WARN_STREAM("Pattern not found for pattern: "<<pattern_ <<" with symmetry: "<< sym_circle_);
-    return 0;
-  }
-
-  ROS_INFO_STREAM("Number of points found on board: "<<observation_pts_.size());
-  camera_obs_.observations.resize(observation_pts_.size());
-  for (int i = 0; i < observation_pts_.size(); i++)
-  {
-    camera_obs_.observations.at(i).target = instance_target_;
-    camera_obs_.observations.at(i).point_id = i;
-    camera_obs_.observations.at(i).image_loc_x = observation_pts_.at(i).x;
-    camera_obs_.observations.at(i).image_loc_y = observation_pts_.at(i).y;
+    ROS_WARN_STREAM("Pattern not found for target "<<request.target->target_name<<" pattern: "<<request.pattern
+                    <<" with symmetry: "<< request.sym_circle);
+    return;
   }
-
-  cam_obs = camera_obs_;
-  return 1;
+  ROS_INFO_STREAM("Number of points found on board "<<request.target->target_name<<": "<<request.observation_pts.size());
 }
 
 void ROSCameraObserver::triggerCamera()
 {
+  // drop the previous image so observationsDone() only reports this trigger's image
+  input_bridge_.reset();
 
-  sensor_msgs::ImageConstPtr recent_image = ros::topic::waitForMessage<sensor_msgs::Image>(image_topic_);
+  // a zero duration waits indefinitely
+  sensor_msgs::ImageConstPtr recent_image = ros::topic::waitForMessage<sensor_msgs::Image>(
+      image_topic_, nh_, ros::Duration(trigger_timeout_));
   //ROS_INFO_STREAM("Waiting for image on topic: "<<image_topic_);
+  if (!recent_image)
+  {
+    // no image within the timeout, or the node is shutting down
+    return;
+  }
   try
   {
-    input_bridge_ = cv_bridge::toCvCopy(recent_image, "mono8");
-    output_bridge_ = cv_bridge::toCvCopy(recent_image, "bgr8");
-    out_bridge_ = cv_bridge::toCvCopy(recent_image, "mono8");
+    // a mono8 image is used in place, any other encoding is converted once
+    input_bridge_ = cv_bridge::toCvShare(recent_image, sensor_msgs::image_encodings::MONO8);
     ROS_INFO_STREAM("cv image created based on ros image");
   }
   catch (cv_bridge::Exception& ex)
   {
     ROS_ERROR("Failed to convert image");
     ROS_WARN_STREAM("cv_bridge exception: "<<ex.what());
+    input_bridge_.reset();
     //return false;
     return;
   }
@@ -0,0 +1,67 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <industrial_extrinsic_cal/scene_registry.h>
+
+namespace industrial_extrinsic_cal
+{
+
+SceneRegistry::SceneRegistry()
+{
+}
+
+SceneRegistry::~SceneRegistry()
+{
+}
+
+int SceneRegistry::add(int scene_id)
+{
+  std::pair<boost::unordered_map<int, int>::iterator, bool> result =
+      indexes_.insert(std::make_pair(scene_id, static_cast<int>(scene_ids_.size())));
+  if (result.second)
+  {
+    scene_ids_.push_back(scene_id);
+  }
+  return result.first->second;
+}
+
+int SceneRegistry::find(int scene_id) const
+{
+  boost::unordered_map<int, int>::const_iterator it = indexes_.find(scene_id);
+  if (it == indexes_.end())
+  {
+    return (-1);
+  }
+  return it->second;
+}
+
+int SceneRegistry::sceneId(int index) const
+{
+  if (index < 0 || index >= static_cast<int>(scene_ids_.size()))
+  {
+    return (-1);
+  }
+  return scene_ids_[index];
+}
+
+int SceneRegistry::size() const
+{
+  return static_cast<int>(scene_ids_.size());
+}
+
+}//end namespace industrial_extrinsic_cal
@@ -0,0 +1,94 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <industrial_extrinsic_cal/solver_monitor.h>
+#include <std_msgs/Float64MultiArray.h>
+
+namespace industrial_extrinsic_cal
+{
+
+void SolverMonitor::start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  records_.clear();
+  budget_exceeded_ = false;
+  next_solve_id_ = 0;
+  start_time_ = ros::WallTime::now();
+}
+
+int SolverMonitor::nextSolveId()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return next_solve_id_++;
+}
+
+ceres::CallbackReturnType SolverMonitor::record(int solve_id, bool limited, const ceres::IterationSummary &summary)
+{
+  IterationRecord record;
+  record.solve_id = solve_id;
+  record.limited = limited;
+  record.iteration = summary.iteration;
+  record.cost = summary.cost;
+  record.gradient_max_norm = summary.gradient_max_norm;
+  record.step_time = summary.iteration_time_in_seconds;
+  record.linear_solver_time = summary.step_solver_time_in_seconds;
+  record.elapsed_time = (ros::WallTime::now() - start_time_).toSec();
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    records_.push_back(record);
+  }
+
+  if (publish_)
+  {
+    std_msgs::Float64MultiArray msg;
+    msg.data.resize(7);
+    msg.data[0] = record.iteration;
+    msg.data[1] = record.cost;
+    msg.data[2] = record.gradient_max_norm;
+    msg.data[3] = record.step_time;
+    msg.data[4] = record.linear_solver_time;
+    msg.data[5] = record.elapsed_time;
+    msg.data[6] = record.solve_id;
+    publisher_.publish(msg);
+  }
+
+  if (!limited)
+  {
+    return ceres::SOLVER_CONTINUE;
+  }
+  // terminating successfully keeps the estimate reached so far
+  if (time_budget_ > 0.0 && record.elapsed_time >= time_budget_)
+  {
+    ROS_WARN_STREAM("Solver time budget of "<<time_budget_<<"s exhausted at iteration "<<summary.iteration
+                    <<" of solve "<<solve_id);
+    boost::mutex::scoped_lock lock(mutex_);
+    budget_exceeded_ = true;
+    return ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+  }
+  double previous_cost = summary.cost + summary.cost_change;
+  if (min_relative_improvement_ > 0.0 && summary.iteration > 0 && summary.step_is_successful
+      && previous_cost > 0.0 && summary.cost_change < min_relative_improvement_ * previous_cost)
+  {
+    ROS_DEBUG_STREAM("Relative improvement "<<summary.cost_change / previous_cost<<" below "
+                     <<min_relative_improvement_<<" at iteration "<<summary.iteration);
+    return ceres::SOLVER_TERMINATE_SUCCESSFULLY;
+  }
+  return ceres::SOLVER_CONTINUE;
+}
+
+}//end namespace industrial_extrinsic_cal
@@ -0,0 +1,339 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <industrial_extrinsic_cal/solver_planner.h>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <ros/console.h>
+#include <yaml-cpp/yaml.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+namespace industrial_extrinsic_cal
+{
+
+/*! @brief the linear solver and preconditioner found fastest by autoTune() */
+typedef std::pair<ceres::LinearSolverType, ceres::PreconditionerType> TunedSolver;
+
+/*! @brief identifies the problems sharing an auto-tuned solver: the same job with the same free blocks */
+struct TuneKey
+{
+  std::string job; /*!< the cache key given to autoTune(), e.g. the job file name */
+  int num_camera_blocks; /*!< free camera blocks */
+  int num_target_pose_blocks; /*!< free target pose blocks */
+  int num_point_blocks; /*!< free point blocks */
+  bool ordered; /*!< whether the Schur candidates ran under an explicit elimination ordering */
+
+  bool operator<(const TuneKey &other) const
+  {
+    if (job != other.job)
+    {
+      return job < other.job;
+    }
+    if (num_camera_blocks != other.num_camera_blocks)
+    {
+      return num_camera_blocks < other.num_camera_blocks;
+    }
+    if (num_target_pose_blocks != other.num_target_pose_blocks)
+    {
+      return num_target_pose_blocks < other.num_target_pose_blocks;
+    }
+    if (num_point_blocks != other.num_point_blocks)
+    {
+      return num_point_blocks < other.num_point_blocks;
+    }
+    return ordered < other.ordered;
+  }
+};
+
+static std::map<TuneKey, TunedSolver> tuned_solvers; // auto-tuned solver of each job and problem structure
+static boost::mutex tuned_solvers_mutex; // guards tuned_solvers
+
+#if defined(CERES_NO_SUITESPARSE) && defined(CERES_NO_CXSPARSE)
+static const bool sparse_available = false;
+#else
+static const bool sparse_available = true;
+#endif
+
+// largest number of free camera parameters for which a dense factorization is cheaper than a sparse one
+static const int max_dense_parameters = 200;
+
+// residual blocks evaluated per thread, fewer than this and the threads cost more than they save
+static const int residual_blocks_per_thread = 1000;
+
+SolverPlanner::SolverPlanner() :
+    max_threads_(std::max(1, static_cast<int>(boost::thread::hardware_concurrency()))), tune_iterations_(3)
+{
+}
+
+void SolverPlanner::plan(const ProblemStructure &structure, ceres::Solver::Options &options) const
+{
+  int num_eliminated = structure.num_target_pose_blocks + structure.num_point_blocks;
+  int num_camera_parameters = 6 * structure.num_camera_blocks;
+
+  if (num_eliminated == 0)
+  {
+    // every residual only sees camera blocks, there is nothing for a Schur complement to eliminate
+    if (num_camera_parameters <= max_dense_parameters)
+    {
+      options.linear_solver_type = ceres::DENSE_QR;
+    }
+    else if (sparse_available)
+    {
+      options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    }
+    else
+    {
+      options.linear_solver_type = ceres::DENSE_NORMAL_CHOLESKY;
+    }
+  }
+  else
+  {
+    // the size of the reduced camera system decides how to factor it
+    if (num_camera_parameters <= max_dense_parameters)
+    {
+      options.linear_solver_type = ceres::DENSE_SCHUR;
+    }
+    else if (sparse_available)
+    {
+      options.linear_solver_type = ceres::SPARSE_SCHUR;
+    }
+    else
+    {
+      options.linear_solver_type = ceres::ITERATIVE_SCHUR;
+      options.preconditioner_type = ceres::SCHUR_JACOBI;
+    }
+  }
+
+  options.num_threads = std::max(1, std::min(max_threads_, structure.num_residual_blocks / residual_blocks_per_thread));
+  ROS_DEBUG_STREAM("Planned "<<ceres::LinearSolverTypeToString(options.linear_solver_type)<<" with "
+                   <<options.num_threads<<" threads for "<<structure.num_camera_blocks<<" camera, "
+                   <<structure.num_target_pose_blocks<<" target pose and "<<structure.num_point_blocks
+                   <<" point blocks");
+}
+
+void SolverPlanner::candidateOptions(const ProblemStructure &structure, const ceres::Solver::Options &options,
+                                     std::vector<ceres::Solver::Options> &candidates) const
+{
+  std::vector<TunedSolver> solvers;
+  if (structure.num_target_pose_blocks + structure.num_point_blocks == 0)
+  {
+    solvers.push_back(TunedSolver(ceres::DENSE_QR, ceres::JACOBI));
+    solvers.push_back(TunedSolver(ceres::DENSE_NORMAL_CHOLESKY, ceres::JACOBI));
+    if (sparse_available)
+    {
+      solvers.push_back(TunedSolver(ceres::SPARSE_NORMAL_CHOLESKY, ceres::JACOBI));
+    }
+  }
+  else
+  {
+    solvers.push_back(TunedSolver(ceres::DENSE_SCHUR, ceres::JACOBI));
+    if (sparse_available)
+    {
+      solvers.push_back(TunedSolver(ceres::SPARSE_SCHUR, ceres::JACOBI));
+    }
+    solvers.push_back(TunedSolver(ceres::ITERATIVE_SCHUR, ceres::SCHUR_JACOBI));
+  }
+
+  candidates.clear();
+  candidates.push_back(options);
+  BOOST_FOREACH(const TunedSolver &solver, solvers)
+  {
+    if (solver.first == options.linear_solver_type)
+    {
+      continue;
+    }
+    candidates.push_back(options);
+    candidates.back().linear_solver_type = solver.first;
+    candidates.back().preconditioner_type = solver.second;
+  }
+}
+
+/** @brief true for the linear solvers which eliminate the target pose and point blocks */
+static bool isSchurSolver(ceres::LinearSolverType type)
+{
+  return type == ceres::DENSE_SCHUR || type == ceres::SPARSE_SCHUR || type == ceres::ITERATIVE_SCHUR;
+}
+
+bool SolverPlanner::attachOrdering(const ceres::ParameterBlockOrdering &ordering, ceres::Solver::Options &options)
+{
+  if (!isSchurSolver(options.linear_solver_type))
+  {
+    return false;
+  }
+  // Ceres 1.10 replaced the owning raw pointer by a shared pointer
+#if CERES_VERSION_MAJOR > 1 || (CERES_VERSION_MAJOR == 1 && CERES_VERSION_MINOR >= 10)
+  options.linear_solver_ordering.reset(new ceres::ParameterBlockOrdering(ordering));
+#else
+  options.linear_solver_ordering = new ceres::ParameterBlockOrdering(ordering);
+#endif
+  return true;
+}
+
+void SolverPlanner::autoTune(ceres::Problem &problem, const ProblemStructure &structure,
+                             const ceres::ParameterBlockOrdering *ordering, const std::string &cache_key,
+                             ceres::Solver::Options &options)
+{
+  plan(structure, options);
+  TuneKey key;
+  key.job = cache_key;
+  key.num_camera_blocks = structure.num_camera_blocks;
+  key.num_target_pose_blocks = structure.num_target_pose_blocks;
+  key.num_point_blocks = structure.num_point_blocks;
+  key.ordered = ordering != NULL;
+  {
+    boost::mutex::scoped_lock lock(tuned_solvers_mutex);
+    std::map<TuneKey, TunedSolver>::const_iterator it = tuned_solvers.find(key);
+    // a hand-edited cache may hold a solver of the wrong family, that entry is tuned again
+    if (it != tuned_solvers.end()
+        && isSchurSolver(it->second.first) == (structure.num_target_pose_blocks + structure.num_point_blocks > 0))
+    {
+      options.linear_solver_type = it->second.first;
+      options.preconditioner_type = it->second.second;
+      return;
+    }
+  }
+
+  // the trials move the parameters, keep a copy to restore after each one
+  std::vector<double*> blocks;
+  problem.GetParameterBlocks(&blocks);
+  std::vector<std::vector<double> > initial_values(blocks.size());
+  for (size_t i = 0; i < blocks.size(); i++)
+  {
+    initial_values[i].assign(blocks[i], blocks[i] + problem.ParameterBlockSize(blocks[i]));
+  }
+
+  std::vector<ceres::Solver::Options> candidates;
+  candidateOptions(structure, options, candidates);
+  TunedSolver best(options.linear_solver_type, options.preconditioner_type);
+  double best_time = -1.0;
+  BOOST_FOREACH(ceres::Solver::Options trial_options, candidates)
+  {
+    trial_options.max_num_iterations = tune_iterations_;
+    trial_options.minimizer_progress_to_stdout = false;
+    trial_options.callbacks.clear();
+    // each trial runs under the ordering the final solve uses
+    if (ordering != NULL)
+    {
+      attachOrdering(*ordering, trial_options);
+    }
+    ceres::Solver::Summary summary;
+    ceres::Solve(trial_options, &problem, &summary);
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+      std::copy(initial_values[i].begin(), initial_values[i].end(), blocks[i]);
+    }
+    if (!summary.IsSolutionUsable())
+    {
+      continue;
+    }
+    int num_iterations = std::max(1, summary.num_successful_steps + summary.num_unsuccessful_steps);
+    double iteration_time = summary.total_time_in_seconds / num_iterations;
+    ROS_DEBUG_STREAM(ceres::LinearSolverTypeToString(trial_options.linear_solver_type)<<" takes "
+                     <<iteration_time<<"s per iteration");
+    if (best_time < 0.0 || iteration_time < best_time)
+    {
+      best_time = iteration_time;
+      best = TunedSolver(trial_options.linear_solver_type, trial_options.preconditioner_type);
+    }
+  }
+
+  ROS_INFO_STREAM("Auto-tuned "<<cache_key<<" to "<<ceres::LinearSolverTypeToString(best.first));
+  options.linear_solver_type = best.first;
+  options.preconditioner_type = best.second;
+  boost::mutex::scoped_lock lock(tuned_solvers_mutex);
+  tuned_solvers[key] = best;
+}
+
+bool SolverPlanner::loadCache(const std::string &file_name)
+{
+  std::ifstream cache_file(file_name.c_str());
+  if (cache_file.fail())
+  {
+    ROS_WARN_STREAM("No solver cache in "<<file_name);
+    return false;
+  }
+  try
+  {
+    YAML::Parser cache_parser(cache_file);
+    YAML::Node cache_doc;
+    if (!cache_parser.GetNextDocument(cache_doc))
+    {
+      return true;
+    }
+    boost::mutex::scoped_lock lock(tuned_solvers_mutex);
+    for (unsigned int i = 0; i < cache_doc.size(); i++)
+    {
+      // caches written before the structure was part of the key have no blocks, those entries are tuned again
+      if (!cache_doc[i].FindValue("camera_blocks"))
+      {
+        continue;
+      }
+      TuneKey key;
+      std::string solver_name, preconditioner_name;
+      cache_doc[i]["job"] >> key.job;
+      cache_doc[i]["camera_blocks"] >> key.num_camera_blocks;
+      cache_doc[i]["target_pose_blocks"] >> key.num_target_pose_blocks;
+      cache_doc[i]["point_blocks"] >> key.num_point_blocks;
+      cache_doc[i]["ordered"] >> key.ordered;
+      cache_doc[i]["linear_solver"] >> solver_name;
+      cache_doc[i]["preconditioner"] >> preconditioner_name;
+      TunedSolver solver;
+      if (!ceres::StringToLinearSolverType(solver_name, &solver.first)
+          || !ceres::StringToPreconditionerType(preconditioner_name, &solver.second))
+      {
+        ROS_ERROR_STREAM("Unknown solver "<<solver_name<<" or preconditioner "<<preconditioner_name
+                         <<" in "<<file_name);
+        return false;
+      }
+      tuned_solvers[key] = solver;
+    }
+  }
+  catch (YAML::Exception& e)
+  {
+    ROS_ERROR_STREAM("Failed to read the solver cache "<<file_name<<" with exception "<<e.what());
+    return false;
+  }
+  return true;
+}
+
+bool SolverPlanner::saveCache(const std::string &file_name)
+{
+  std::ofstream cache_file(file_name.c_str());
+  if (cache_file.fail())
+  {
+    ROS_ERROR_STREAM("Couldn't open the solver cache "<<file_name);
+    return false;
+  }
+  boost::mutex::scoped_lock lock(tuned_solvers_mutex);
+  std::map<TuneKey, TunedSolver>::const_iterator it;
+  for (it = tuned_solvers.begin(); it != tuned_solvers.end(); ++it)
+  {
+    cache_file<<"- job: \""<<it->first.job<<"\"\n";
+    cache_file<<"  camera_blocks: "<<it->first.num_camera_blocks<<"\n";
+    cache_file<<"  target_pose_blocks: "<<it->first.num_target_pose_blocks<<"\n";
+    cache_file<<"  point_blocks: "<<it->first.num_point_blocks<<"\n";
+    cache_file<<"  ordered: "<<(it->first.ordered ? "true" : "false")<<"\n";
+    cache_file<<"  linear_solver: "<<ceres::LinearSolverTypeToString(it->second.first)<<"\n";
+    cache_file<<"  preconditioner: "<<ceres::PreconditionerTypeToString(it->second.second)<<"\n";
+  }
+  return true;
+}
+
+}//end namespace industrial_extrinsic_cal
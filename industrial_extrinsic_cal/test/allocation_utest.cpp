@@ -0,0 +1,188 @@
+/*
+ * Software License Agreement (Apache License)
+ *
+ * Copyright (c) 2014, Southwest Research Institute
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// replaces the global operator new, which is why these tests have an executable of their own
+
+#include <industrial_extrinsic_cal/calibration_job_definition.h>
+
+#include <gtest/gtest.h>
+#include <boost/atomic.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+using namespace industrial_extrinsic_cal;
+
+// counts the heap allocations made while counting_allocations is set, by the test and by the job's worker threads
+static boost::atomic<bool> counting_allocations(false);
+static boost::atomic<size_t> allocation_count(0);
+
+void* operator new(std::size_t size) throw (std::bad_alloc)
+{
+  if (counting_allocations)
+  {
+    allocation_count++;
+  }
+  void *memory = std::malloc(size > 0 ? size : 1);
+  if (memory == NULL)
+  {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+void operator delete(void *memory) throw ()
+{
+  std::free(memory);
+}
+
+/*! @brief exposes the data collection stage of the calibration job */
+class ObservingCalibrationJob : public CalibrationJob
+{
+public:
+  ObservingCalibrationJob() :
+      CalibrationJob("", "", "")
+  {
+  }
+  using CalibrationJob::runObservations;
+  using CalibrationJob::getObservationStore;
+  using CalibrationJob::addScene;
+};
+
+/*! @brief reports every point of its targets at the image origin, without any images */
+class StubCameraObserver : public CameraObserver
+{
+public:
+  bool addTarget(boost::shared_ptr<Target> targ, Roi &roi)
+  {
+    targets_.push_back(targ);
+    return true;
+  }
+  void clearTargets()
+  {
+    targets_.clear();
+  }
+  void clearObservations()
+  {
+  }
+  int getObservations(CameraObservations &camera_observations)
+  {
+    camera_observations.observations.clear();
+    BOOST_FOREACH(const boost::shared_ptr<Target> &target, targets_)
+    {
+      Observation observation;
+      observation.target_index = target->target_id;
+      observation.image_loc_x = 0.0;
+      observation.image_loc_y = 0.0;
+      for (int i = 0; i < target->pts.size(); i++)
+      {
+        observation.point_id = i;
+        camera_observations.observations.push_back(observation);
+      }
+    }
+    return 1;
+  }
+  void triggerCamera()
+  {
+  }
+  bool observationsDone()
+  {
+    return true;
+  }
+
+private:
+  std::vector<boost::shared_ptr<Target> > targets_;
+};
+
+/*! @brief heap allocations of the second runObservations() of a job, a static and a moving camera
+ *         observe a static and a moving target in each scene */
+size_t repeatedObservationAllocations(int num_scenes, int num_points)
+{
+  ObservingCalibrationJob job;
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Camera> cameras[2];
+  boost::shared_ptr<Target> targets[2];
+  for (int i = 0; i < 2; i++)
+  {
+    cameras[i] = boost::make_shared<Camera>(i ? "moving_camera" : "static_camera", camera_parameters, i == 1);
+    cameras[i]->camera_observer_ = boost::make_shared<StubCameraObserver>();
+    targets[i] = boost::make_shared<Target>();
+    targets[i]->target_name = i ? "moving_target" : "static_target";
+    targets[i]->is_moving = (i == 1);
+    targets[i]->pts.resize(num_points);
+  }
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    ObservationScene scene(trigger, scene_id);
+    for (int i = 0; i < 2; i++)
+    {
+      scene.populateObsCmdList(cameras[i], targets[i], roi);
+      scene.addCameraToScene(cameras[i]);
+    }
+    job.addScene(scene);
+  }
+
+  EXPECT_TRUE(job.runObservations());
+  allocation_count = 0;
+  counting_allocations = true;
+  bool rtn = job.runObservations();
+  counting_allocations = false;
+  EXPECT_TRUE(rtn);
+  EXPECT_EQ(2 * num_scenes * num_points, job.getObservationStore().size());
+  EXPECT_EQ(targets[0]->target_id, job.getObservationStore().targetId(0));
+  return allocation_count;
+}
+
+TEST(IndustrialExtrinsicCalAllocationSuite, observation_allocations)
+{
+  // Only the observation collection of a repeated runObservations() is covered: clearing and reusing the blocks
+  // in their arena, triggering, detecting and storing the observations. The problem built by runOptimization()
+  // is not, ceres allocates every residual block it is given.
+  // Each scene triggers and registers its cameras, which may allocate the same amount in every scene, nothing may
+  // grow with the number of observed points or with the observations stored by the earlier scenes.
+  const int num_points[] = { 10, 1000 };
+  size_t allocations[3][2];
+  for (int s = 0; s < 3; s++)
+  {
+    for (int p = 0; p < 2; p++)
+    {
+      allocations[s][p] = repeatedObservationAllocations(2 * (s + 1), num_points[p]);
+    }
+  }
+  size_t per_scene = (allocations[1][0] - allocations[0][0]) / 2;
+  std::cout<<"allocations of a repeated run of 2 scenes: "<<allocations[0][0]<<", per additional scene: "
+           <<per_scene<<std::endl;
+  for (int s = 0; s < 3; s++)
+  {
+    // no allocation per observation
+    EXPECT_EQ(allocations[s][0], allocations[s][1]);
+    // exactly the same allocations for each scene
+    EXPECT_EQ(allocations[0][0] + 2 * s * per_scene, allocations[s][0]);
+  }
+}
+
+// Run all the tests that were declared with TEST()
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
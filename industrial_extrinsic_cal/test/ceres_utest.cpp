@@ -18,11 +18,20 @@
 
 
 #include <industrial_extrinsic_cal/ceres_costs_utils.hpp>
+#include <industrial_extrinsic_cal/ceres_costs_utils_test.hpp>
+#include <industrial_extrinsic_cal/calibration_job_definition.h>
+#include <industrial_extrinsic_cal/solver_monitor.h>
+#include <industrial_extrinsic_cal/solver_planner.h>
+#include <industrial_extrinsic_cal/parameter_arena.h>
+#include <industrial_extrinsic_cal/scene_registry.h>
+#include <ros/time.h>
 
 #include <gtest/gtest.h>
 #include <yaml-cpp/yaml.h>
+#include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 
 #include <Eigen/Geometry>
 #include <Eigen/Core>
@@ -30,6 +39,376 @@
 using namespace industrial_extrinsic_cal;
 
 Point3d transformPoint(Point3d &original_point, double &ax, double &ay, double &az, double &x, double&y, double &z);
+void compareCostFunctions(ceres::CostFunction* expected, ceres::CostFunction* actual, std::vector<double*> &blocks);
+double evaluationsPerSecond(ceres::CostFunction* cost_function, std::vector<double*> &blocks);
+
+/*! @brief exposes the outlier pruning stage of the calibration job */
+class PruningCalibrationJob : public CalibrationJob
+{
+public:
+  PruningCalibrationJob() :
+      CalibrationJob("", "", "")
+  {
+  }
+  using CalibrationJob::pruneOutliers;
+  using CalibrationJob::getObservationStore;
+};
+
+/*! @brief exposes the data collection stage of the calibration job */
+class ObservingCalibrationJob : public CalibrationJob
+{
+public:
+  ObservingCalibrationJob() :
+      CalibrationJob("", "", "")
+  {
+  }
+  using CalibrationJob::runObservations;
+  using CalibrationJob::getObservationStore;
+  using CalibrationJob::addScene;
+  using CalibrationJob::numPendingTriggers;
+  using CalibrationJob::getPendingTrigger;
+  using CalibrationJob::partitionObservations;
+  using CalibrationJob::defineCamera;
+  using CalibrationJob::defineTarget;
+};
+
+/*! @brief reports every point of its targets at the image origin, without any images */
+class StubCameraObserver : public CameraObserver
+{
+public:
+  bool addTarget(boost::shared_ptr<Target> targ, Roi &roi)
+  {
+    targets_.push_back(targ);
+    return true;
+  }
+  void clearTargets()
+  {
+    targets_.clear();
+  }
+  void clearObservations()
+  {
+  }
+  int getObservations(CameraObservations &camera_observations)
+  {
+    camera_observations.observations.clear();
+    BOOST_FOREACH(const boost::shared_ptr<Target> &target, targets_)
+    {
+      Observation observation;
+      observation.target_index = target->target_id;
+      observation.image_loc_x = 0.0;
+      observation.image_loc_y = 0.0;
+      for (int i = 0; i < target->pts.size(); i++)
+      {
+        observation.point_id = i;
+        camera_observations.observations.push_back(observation);
+      }
+    }
+    return 1;
+  }
+  void triggerCamera()
+  {
+  }
+  bool observationsDone()
+  {
+    return true;
+  }
+
+protected:
+  std::vector<boost::shared_ptr<Target> > targets_;
+};
+
+/*! @brief a stub observer which reports the exact projection of its targets' points from a known camera pose */
+class ProjectingCameraObserver : public StubCameraObserver
+{
+public:
+  /** @param extrinsics the true camera pose, angle axis followed by position */
+  /** @param camera_parameters the intrinsics of the camera */
+  ProjectingCameraObserver(const double extrinsics[6], const CameraParameters &camera_parameters) :
+      camera_parameters_(camera_parameters)
+  {
+    std::copy(extrinsics, extrinsics + 6, extrinsics_);
+  }
+  int getObservations(CameraObservations &camera_observations)
+  {
+    camera_observations.observations.clear();
+    BOOST_FOREACH(const boost::shared_ptr<Target> &target, targets_)
+    {
+      for (int i = 0; i < target->pts.size(); i++)
+      {
+        double camera_point[3];
+        ceres::AngleAxisRotatePoint(extrinsics_, target->pts[i].pb, camera_point);
+        Observation observation;
+        observation.target_index = target->target_id;
+        observation.point_id = i;
+        observation.image_loc_x = camera_parameters_.focal_length_x * (camera_point[0] + extrinsics_[3])
+            / (camera_point[2] + extrinsics_[5]) + camera_parameters_.center_x;
+        observation.image_loc_y = camera_parameters_.focal_length_y * (camera_point[1] + extrinsics_[4])
+            / (camera_point[2] + extrinsics_[5]) + camera_parameters_.center_y;
+        camera_observations.observations.push_back(observation);
+      }
+    }
+    return 1;
+  }
+
+private:
+  double extrinsics_[6];
+  CameraParameters camera_parameters_;
+};
+
+/*! @brief a ProjectingCameraObserver which counts how often it was triggered */
+class CountingCameraObserver : public ProjectingCameraObserver
+{
+public:
+  CountingCameraObserver(const double extrinsics[6], const CameraParameters &camera_parameters) :
+      ProjectingCameraObserver(extrinsics, camera_parameters), num_triggers_(0)
+  {
+  }
+  ~CountingCameraObserver()
+  {
+    joinTrigger();
+  }
+  void triggerCamera()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    num_triggers_++;
+  }
+  int numTriggers()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_triggers_;
+  }
+
+private:
+  boost::mutex mutex_;
+  int num_triggers_;
+};
+
+/*! @brief a stub observer which reports the exact projection of its targets' points from a known camera pose,
+ *         with the targets at the next of a list of known poses each time it is read */
+class MovingTargetCameraObserver : public StubCameraObserver
+{
+public:
+  /** @param extrinsics the true camera pose, angle axis followed by position */
+  /** @param camera_parameters the intrinsics of the camera */
+  /** @param target_poses the true target pose of each read, position followed by angle axis as in Pose6d */
+  MovingTargetCameraObserver(const double extrinsics[6], const CameraParameters &camera_parameters,
+                             const std::vector<std::vector<double> > &target_poses) :
+      camera_parameters_(camera_parameters), target_poses_(target_poses), num_reads_(0)
+  {
+    std::copy(extrinsics, extrinsics + 6, extrinsics_);
+  }
+  int getObservations(CameraObservations &camera_observations)
+  {
+    const std::vector<double> &target_pose = target_poses_[std::min(num_reads_++, target_poses_.size() - 1)];
+    camera_observations.observations.clear();
+    BOOST_FOREACH(const boost::shared_ptr<Target> &target, targets_)
+    {
+      for (int i = 0; i < target->pts.size(); i++)
+      {
+        double world_point[3];
+        double camera_point[3];
+        ceres::AngleAxisRotatePoint(&target_pose[3], target->pts[i].pb, world_point);
+        for (int k = 0; k < 3; k++)
+        {
+          world_point[k] += target_pose[k];
+        }
+        ceres::AngleAxisRotatePoint(extrinsics_, world_point, camera_point);
+        Observation observation;
+        observation.target_index = target->target_id;
+        observation.point_id = i;
+        observation.image_loc_x = camera_parameters_.focal_length_x * (camera_point[0] + extrinsics_[3])
+            / (camera_point[2] + extrinsics_[5]) + camera_parameters_.center_x;
+        observation.image_loc_y = camera_parameters_.focal_length_y * (camera_point[1] + extrinsics_[4])
+            / (camera_point[2] + extrinsics_[5]) + camera_parameters_.center_y;
+        camera_observations.observations.push_back(observation);
+      }
+    }
+    return 1;
+  }
+
+private:
+  double extrinsics_[6];
+  CameraParameters camera_parameters_;
+  std::vector<std::vector<double> > target_poses_;
+  size_t num_reads_;
+};
+
+/*! @brief a static camera 1m in front of the targets, seen by a ProjectingCameraObserver, whose own pose starts
+ *         off the truth by offset in every parameter */
+boost::shared_ptr<Camera> makeProjectingCamera(const std::string &name, const double truth[6], double offset)
+{
+  CameraParameters camera_parameters;
+  camera_parameters.focal_length_x = 525.0;
+  camera_parameters.focal_length_y = 525.0;
+  camera_parameters.center_x = 320.0;
+  camera_parameters.center_y = 240.0;
+  for (int i = 0; i < 6; i++)
+  {
+    camera_parameters.pb_extrinsics[i] = truth[i] + offset;
+  }
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>(name, camera_parameters, false);
+  camera->camera_observer_ = boost::make_shared<ProjectingCameraObserver>(truth, camera_parameters);
+  return camera;
+}
+
+/*! @brief a static planar grid target with points 3cm apart */
+boost::shared_ptr<Target> makeGridTarget(const std::string &name, int rows, int cols)
+{
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = name;
+  target->is_moving = false;
+  target->pts.resize(rows * cols);
+  for (int i = 0; i < rows * cols; i++)
+  {
+    target->pts[i].x = 0.03 * (i % cols);
+    target->pts[i].y = 0.03 * (i / cols);
+    target->pts[i].z = 0.0;
+  }
+  target->num_points = rows * cols;
+  return target;
+}
+
+/*! @brief triggered cameras wait here for each other, they only all meet when they are triggered concurrently */
+struct TriggerRendezvous
+{
+  boost::mutex mutex;
+  boost::condition_variable arrived;
+  int expected; /*!< cameras which have to meet */
+  int waiting; /*!< cameras waiting right now */
+  bool met; /*!< every camera was waiting at once */
+};
+
+/*! @brief a stub observer whose trigger blocks until every camera of the rendezvous was triggered, or 2 seconds */
+class RendezvousCameraObserver : public StubCameraObserver
+{
+public:
+  explicit RendezvousCameraObserver(TriggerRendezvous *rendezvous) :
+      rendezvous_(rendezvous)
+  {
+  }
+  void triggerCamera()
+  {
+    boost::mutex::scoped_lock lock(rendezvous_->mutex);
+    rendezvous_->waiting++;
+    rendezvous_->arrived.notify_all();
+    boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(2);
+    while (rendezvous_->waiting < rendezvous_->expected && !rendezvous_->met)
+    {
+      if (!rendezvous_->arrived.timed_wait(lock, timeout))
+      {
+        rendezvous_->waiting--;
+        return;
+      }
+    }
+    rendezvous_->met = true;
+    rendezvous_->arrived.notify_all();
+  }
+
+private:
+  TriggerRendezvous *rendezvous_;
+};
+
+/*! @brief a stub observer whose trigger blocks until the test opens its gate, like a camera without images,
+ *         it records being reconfigured while a trigger is blocked */
+class GatedCameraObserver : public StubCameraObserver
+{
+public:
+  GatedCameraObserver() :
+      open_(false), triggering_(false), reconfigured_while_triggering_(false)
+  {
+  }
+  ~GatedCameraObserver()
+  {
+    // a failed test may leave the trigger blocked
+    open();
+    joinTrigger();
+  }
+  bool addTarget(boost::shared_ptr<Target> targ, Roi &roi)
+  {
+    noteReconfiguration();
+    return StubCameraObserver::addTarget(targ, roi);
+  }
+  void clearTargets()
+  {
+    noteReconfiguration();
+    StubCameraObserver::clearTargets();
+  }
+  void clearObservations()
+  {
+    noteReconfiguration();
+  }
+  void triggerCamera()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    triggering_ = true;
+    while (!open_)
+    {
+      opened_.wait(lock);
+    }
+    triggering_ = false;
+  }
+  void open()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    open_ = true;
+    opened_.notify_all();
+  }
+  bool reconfiguredWhileTriggering()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return reconfigured_while_triggering_;
+  }
+
+private:
+  void noteReconfiguration()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    reconfigured_while_triggering_ = reconfigured_while_triggering_ || triggering_;
+  }
+
+  boost::mutex mutex_;
+  boost::condition_variable opened_;
+  bool open_;
+  bool triggering_;
+  bool reconfigured_while_triggering_;
+};
+
+/*! @brief a stub observer whose detection waits until another camera is triggered, or 2 seconds */
+class WaitingCameraObserver : public StubCameraObserver
+{
+public:
+  explicit WaitingCameraObserver(TriggerCompletion *other_triggered) :
+      overlapped_(false), other_triggered_(other_triggered)
+  {
+  }
+  int getObservations(CameraObservations &camera_observations)
+  {
+    TriggerResult result = other_triggered_->wait(boost::get_system_time() + boost::posix_time::seconds(2));
+    overlapped_ = (result == trigger_results::Done);
+    return StubCameraObserver::getObservations(camera_observations);
+  }
+  bool overlapped_; /*!< the other camera was triggered while this one was detecting */
+
+private:
+  TriggerCompletion *other_triggered_;
+};
+
+/*! @brief a stub observer which completes a handle when it is triggered */
+class SignallingCameraObserver : public StubCameraObserver
+{
+public:
+  explicit SignallingCameraObserver(TriggerCompletion *triggered) :
+      triggered_(triggered)
+  {
+  }
+  void triggerCamera()
+  {
+    triggered_->complete(true);
+  }
+
+private:
+  TriggerCompletion *triggered_;
+};
 
 std::vector<Point3d> created_points;
 double aa[3]; // angle axis known/set
@@ -333,6 +712,1138 @@ TEST(DISABLED_IndustrialExtrinsicCalCeresSuite, camera_no_dist_costfunction)
         <<extrinsics[5]<<std::endl;
 }
 
+TEST(IndustrialExtrinsicCalCeresSuite, analytic_jacobians)
+{
+  double extrinsics[6] = { 0.3, -0.7, 1.2, 0.1, -0.2, 1.5 };
+  double small_rotation[6] = { 1e-9, 2e-9, -1e-9, 0.1, -0.2, 1.5 };
+  double target_pose[6] = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6 };
+  double intrinsics[9] = { 525, 530, 320, 240, 0.01, -0.02, 0.003, 0.001, -0.002 };
+  double* camera_poses[2] = { extrinsics, small_rotation };
+
+  for (int c = 0; c < 2; c++)
+  {
+    for (int j = 0; j < created_points.size(); ++j)
+    {
+      double* point = created_points.at(j).pb;
+      std::vector<double*> blocks;
+      blocks.push_back(camera_poses[c]);
+      blocks.push_back(target_pose);
+      compareCostFunctions(TargetCameraReprjErrorNoDistortion::Create(300, 200, 525, 530, 320, 240,
+                                                                      point[0], point[1], point[2]),
+                           TargetCameraReprjErrorNoDistortionAnalytic::Create(300, 200, 525, 530, 320, 240,
+                                                                              point[0], point[1], point[2]),
+                           blocks);
+
+      blocks.clear();
+      blocks.push_back(camera_poses[c]);
+      blocks.push_back(intrinsics);
+      blocks.push_back(point);
+      compareCostFunctions(CameraReprjErrorNoDistortion::Create(300, 200, 525, 530, 320, 240),
+                           CameraReprjErrorNoDistortionAnalytic::Create(300, 200, 525, 530, 320, 240), blocks);
+      compareCostFunctions(CameraReprjErrorWithDistortion::Create(300, 200),
+                           CameraReprjErrorWithDistortionAnalytic::Create(300, 200), blocks);
+    }
+  }
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, analytic_jacobians_benchmark)
+{
+  double extrinsics[6] = { 0.3, -0.7, 1.2, 0.1, -0.2, 1.5 };
+  double target_pose[6] = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6 };
+  double intrinsics[9] = { 525, 530, 320, 240, 0.01, -0.02, 0.003, 0.001, -0.002 };
+  double point[3] = { 0.12, -0.05, 0.3 };
+
+  std::vector<double*> blocks;
+  blocks.push_back(extrinsics);
+  blocks.push_back(target_pose);
+  ceres::CostFunction* target_auto = TargetCameraReprjErrorNoDistortion::Create(300, 200, 525, 530, 320, 240,
+                                                                                point[0], point[1], point[2]);
+  ceres::CostFunction* target_analytic = TargetCameraReprjErrorNoDistortionAnalytic::Create(300, 200, 525, 530, 320,
+                                                                                            240, point[0], point[1],
+                                                                                            point[2]);
+  std::cout<<"TargetCameraReprjErrorNoDistortion evaluations/s autodiff: "<<evaluationsPerSecond(target_auto, blocks)
+      <<" analytic: "<<evaluationsPerSecond(target_analytic, blocks)<<std::endl;
+
+  blocks.clear();
+  blocks.push_back(extrinsics);
+  blocks.push_back(intrinsics);
+  blocks.push_back(point);
+  ceres::CostFunction* no_dist_auto = CameraReprjErrorNoDistortion::Create(300, 200, 525, 530, 320, 240);
+  ceres::CostFunction* no_dist_analytic = CameraReprjErrorNoDistortionAnalytic::Create(300, 200, 525, 530, 320, 240);
+  std::cout<<"CameraReprjErrorNoDistortion evaluations/s autodiff: "<<evaluationsPerSecond(no_dist_auto, blocks)
+      <<" analytic: "<<evaluationsPerSecond(no_dist_analytic, blocks)<<std::endl;
+
+  ceres::CostFunction* dist_auto = CameraReprjErrorWithDistortion::Create(300, 200);
+  ceres::CostFunction* dist_analytic = CameraReprjErrorWithDistortionAnalytic::Create(300, 200);
+  std::cout<<"CameraReprjErrorWithDistortion evaluations/s autodiff: "<<evaluationsPerSecond(dist_auto, blocks)
+      <<" analytic: "<<evaluationsPerSecond(dist_analytic, blocks)<<std::endl;
+
+  delete target_auto;
+  delete target_analytic;
+  delete no_dist_auto;
+  delete no_dist_analytic;
+  delete dist_auto;
+  delete dist_analytic;
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, batched_view_costfunction)
+{
+  double extrinsics[6] = { 0.3, -0.7, 1.2, 0.1, -0.2, 1.5 };
+  double target_pose[6] = { 0.1, 0.2, 0.3, 0.4, 0.5, 0.6 };
+  const double* parameters[2] = { extrinsics, target_pose };
+
+  TargetCameraReprjErrorNoDistortionBatch batch(525, 530, 320, 240);
+  batch.reserve(created_points.size());
+  for (int j = 0; j < created_points.size(); ++j)
+  {
+    batch.addPoint(300 + j, 200 - j, created_points[j].x, created_points[j].y, created_points[j].z);
+  }
+  ASSERT_EQ(2 * created_points.size(), batch.num_residuals());
+
+  std::vector<double> resid(batch.num_residuals());
+  std::vector<double> jacobian_ext(6 * batch.num_residuals());
+  std::vector<double> jacobian_target(6 * batch.num_residuals());
+  double* jacobians[2] = { &jacobian_ext[0], &jacobian_target[0] };
+  EXPECT_TRUE(batch.Evaluate(parameters, &resid[0], jacobians));
+
+  // every pair of rows must equal the single point cost of the same observation
+  for (int j = 0; j < created_points.size(); ++j)
+  {
+    TargetCameraReprjErrorNoDistortionAnalytic single(300 + j, 200 - j, 525, 530, 320, 240, created_points[j].x,
+                                                      created_points[j].y, created_points[j].z);
+    double single_resid[2];
+    double single_ext[12];
+    double single_target[12];
+    double* single_jacobians[2] = { single_ext, single_target };
+    EXPECT_TRUE(single.Evaluate(parameters, single_resid, single_jacobians));
+    EXPECT_NEAR(single_resid[0], resid[2 * j], 1e-9);
+    EXPECT_NEAR(single_resid[1], resid[2 * j + 1], 1e-9);
+    for (int k = 0; k < 12; k++)
+    {
+      EXPECT_NEAR(single_ext[k], jacobian_ext[12 * j + k], 1e-9 * (1.0 + fabs(single_ext[k])));
+      EXPECT_EQ(0.0, jacobian_target[12 * j + k]);
+    }
+  }
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, outlier_pruning)
+{
+  const int rows = 5;
+  const int cols = 7;
+  const int num_points = rows * cols;
+  double intrinsics[4] = { 500, 500, 320, 240 };
+  double truth[6] = { 0.05, -0.03, 0.02, -0.09, -0.06, 1.0 };
+  double extrinsics[6] = { 0.06, -0.02, 0.01, -0.08, -0.07, 1.02 };
+  double target_pose[6] = { 0, 0, 0, 0, 0, 0 };
+  std::vector<double> points(3 * num_points);
+  for (int i = 0; i < num_points; i++)
+  {
+    points[3 * i] = 0.03 * (i % cols);
+    points[3 * i + 1] = 0.03 * (i / cols);
+    points[3 * i + 2] = 0.0;
+  }
+
+  // two views of the same target, the second one detected with its corner order reversed,
+  // and a single corrupted detection in the first one
+  PruningCalibrationJob job;
+  ObservationStore &store = job.getObservationStore();
+  for (int scene = 0; scene < 2; scene++)
+  {
+    store.beginScene(scene);
+    for (int i = 0; i < num_points; i++)
+    {
+      double camera_point[3];
+      transformPointWithJacobian(truth, &points[3 * i], camera_point, NULL, NULL);
+      double image_x = intrinsics[0] * camera_point[0] / camera_point[2] + intrinsics[2];
+      double image_y = intrinsics[1] * camera_point[1] / camera_point[2] + intrinsics[3];
+      int point_id = (scene == 0 ? i : num_points - 1 - i);
+      if (scene == 0 && i == 10)
+      {
+        image_x += 20.0;
+      }
+      store.addObservation(0, 1, scene, point_id, intrinsics, extrinsics, target_pose, &points[3 * point_id], image_x,
+                           image_y);
+    }
+  }
+  ASSERT_EQ(2, store.numScenes());
+  EXPECT_EQ(num_points, store.sceneBegin(1));
+  EXPECT_EQ(3 + num_points, store.numBlocks()); // intrinsics, extrinsics, target pose and every point
+  std::vector<int> observations;
+  for (int row = 0; row < store.size(); row++)
+  {
+    observations.push_back(row);
+  }
+
+  // the robust solve runs to its end even when the time budget of the job is already spent
+  job.getSolverMonitor().setTimeBudget(1e-9);
+  job.getSolverMonitor().start();
+  job.setOutlierPruning(true, 3.0);
+  EXPECT_EQ(num_points + 1, job.pruneOutliers(observations, 1));
+  std::vector<IterationRecord> records = job.getSolverMonitor().getRecords();
+  ASSERT_FALSE(records.empty());
+  EXPECT_GT(records.back().iteration, 0);
+  EXPECT_FALSE(records.back().limited);
+  EXPECT_FALSE(job.getSolverMonitor().budgetExceeded());
+  ASSERT_EQ(num_points - 1, observations.size());
+  for (int i = 0; i < observations.size(); i++)
+  {
+    EXPECT_EQ(0, store.sceneId(observations[i]));
+    EXPECT_NE(10, store.pointId(observations[i]));
+  }
+  for (int k = 0; k < 6; k++)
+  {
+    EXPECT_NEAR(truth[k], extrinsics[k], 1e-2);
+  }
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, solver_monitor)
+{
+  SolverMonitor monitor;
+  monitor.setMinRelativeImprovement(1e-3);
+  monitor.start();
+  SolverMonitor::SolveCallback solve(monitor, true);
+  EXPECT_EQ(0, solve.getSolveId());
+
+  ceres::IterationSummary summary;
+  summary.iteration = 0;
+  summary.cost = 100.0;
+  summary.cost_change = 0.0;
+  summary.step_is_successful = false;
+  EXPECT_EQ(ceres::SOLVER_CONTINUE, solve(summary));
+
+  // a 10% decrease continues, a 0.01% decrease stops
+  summary.iteration = 1;
+  summary.cost = 90.0;
+  summary.cost_change = 10.0;
+  summary.step_is_successful = true;
+  summary.step_solver_time_in_seconds = 0.25;
+  EXPECT_EQ(ceres::SOLVER_CONTINUE, solve(summary));
+  summary.iteration = 2;
+  summary.cost = 89.991;
+  summary.cost_change = 0.009;
+  EXPECT_EQ(ceres::SOLVER_TERMINATE_SUCCESSFULLY, solve(summary));
+
+  // a solve exempt from the stop rules continues, its records carry its own id
+  SolverMonitor::SolveCallback exempt_solve(monitor, false);
+  EXPECT_EQ(1, exempt_solve.getSolveId());
+  EXPECT_EQ(ceres::SOLVER_CONTINUE, exempt_solve(summary));
+
+  std::vector<IterationRecord> records = monitor.getRecords();
+  ASSERT_EQ(4, records.size());
+  EXPECT_EQ(0, records[1].solve_id);
+  EXPECT_TRUE(records[1].limited);
+  EXPECT_EQ(1, records[1].iteration);
+  EXPECT_EQ(90.0, records[1].cost);
+  EXPECT_EQ(0.25, records[1].linear_solver_time);
+  EXPECT_EQ(1, records[3].solve_id);
+  EXPECT_FALSE(records[3].limited);
+  EXPECT_FALSE(monitor.budgetExceeded());
+
+  // a tiny budget ends the next solve at its first iteration, but not an exempt one
+  monitor.setMinRelativeImprovement(0.0);
+  monitor.setTimeBudget(1e-9);
+  monitor.start();
+  SolverMonitor::SolveCallback budget_solve(monitor, true);
+  SolverMonitor::SolveCallback budget_exempt_solve(monitor, false);
+  EXPECT_EQ(0, budget_solve.getSolveId());
+  boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  summary.iteration = 0;
+  EXPECT_EQ(ceres::SOLVER_CONTINUE, budget_exempt_solve(summary));
+  EXPECT_FALSE(monitor.budgetExceeded());
+  EXPECT_EQ(ceres::SOLVER_TERMINATE_SUCCESSFULLY, budget_solve(summary));
+  EXPECT_TRUE(monitor.budgetExceeded());
+  EXPECT_EQ(2, monitor.getRecords().size());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, solver_planner)
+{
+  SolverPlanner planner;
+  planner.setMaxThreads(4);
+  ceres::Solver::Options options;
+
+  // a few cameras and nothing to eliminate
+  ProblemStructure structure;
+  structure.num_camera_blocks = 2;
+  structure.num_target_pose_blocks = 0;
+  structure.num_point_blocks = 0;
+  structure.num_residual_blocks = 70;
+  planner.plan(structure, options);
+  EXPECT_EQ(ceres::DENSE_QR, options.linear_solver_type);
+  EXPECT_EQ(1, options.num_threads);
+
+  // free points leave a small reduced camera system
+  structure.num_point_blocks = 500;
+  planner.plan(structure, options);
+  EXPECT_EQ(ceres::DENSE_SCHUR, options.linear_solver_type);
+
+  // many cameras need a sparse or iterative reduced system, and many residuals get every thread
+  structure.num_camera_blocks = 60;
+  structure.num_target_pose_blocks = 300;
+  structure.num_residual_blocks = 100000;
+  planner.plan(structure, options);
+  EXPECT_NE(ceres::DENSE_SCHUR, options.linear_solver_type);
+  EXPECT_TRUE(options.linear_solver_type == ceres::SPARSE_SCHUR
+              || options.linear_solver_type == ceres::ITERATIVE_SCHUR);
+  EXPECT_EQ(4, options.num_threads);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, schur_ordering)
+{
+  CeresBlocks blocks;
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, false);
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = false;
+  target->pts.resize(3);
+  blocks.addStaticCamera(camera);
+  blocks.addStaticTarget(target);
+
+  // the intrinsics and the last point are not in the problem
+  std::set<P_BLOCK> problem_blocks;
+  problem_blocks.insert(blocks.getStaticCameraParameterBlockExtrinsics("camera"));
+  problem_blocks.insert(blocks.getStaticTargetPoseParameterBlock("target"));
+  problem_blocks.insert(blocks.getStaticTargetPointParameterBlock("target", 0));
+  problem_blocks.insert(blocks.getStaticTargetPointParameterBlock("target", 1));
+
+  ceres::ParameterBlockOrdering ordering;
+  EXPECT_EQ(4, blocks.buildSchurOrdering(problem_blocks, ordering));
+  EXPECT_EQ(4, ordering.NumElements());
+  EXPECT_EQ(schur_groups::Points, ordering.GroupId(blocks.getStaticTargetPointParameterBlock("target", 1)));
+  EXPECT_EQ(schur_groups::TargetPoses, ordering.GroupId(blocks.getStaticTargetPoseParameterBlock("target")));
+  EXPECT_EQ(schur_groups::Extrinsics, ordering.GroupId(blocks.getStaticCameraParameterBlockExtrinsics("camera")));
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, block_lookup_benchmark)
+{
+  const int num_scenes = 10000;
+  CeresBlocks blocks;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = true;
+  target->pts.resize(3);
+
+  ros::WallTime start = ros::WallTime::now();
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    boost::shared_ptr<Target> scene_target = boost::make_shared<Target>(*target);
+    scene_target->pose.x = scene_id;
+    ASSERT_TRUE(blocks.addMovingTarget(scene_target, scene_id));
+  }
+  double add_time = (ros::WallTime::now() - start).toSec();
+  EXPECT_FALSE(blocks.addMovingTarget(target, num_scenes / 2));
+
+  start = ros::WallTime::now();
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    P_BLOCK pose = blocks.getMovingTargetPoseParameterBlock("target", scene_id);
+    ASSERT_TRUE(pose != NULL);
+    EXPECT_EQ(scene_id, pose[0]);
+  }
+  double lookup_time = (ros::WallTime::now() - start).toSec();
+  std::cout<<num_scenes<<" moving target poses, add: "<<add_time<<"s lookup: "<<lookup_time<<"s"<<std::endl;
+
+  EXPECT_TRUE(blocks.getMovingTargetPoseParameterBlock("target", num_scenes) == NULL);
+  EXPECT_TRUE(blocks.getMovingTargetPoseParameterBlock("other", 0) == NULL);
+  blocks.storeParameters();
+  EXPECT_EQ(num_scenes - 1, blocks.getTargetByName("target")->pose.x);
+  EXPECT_TRUE(blocks.getMovingTargetPointParameterBlock("target", 2) != NULL);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, name_table)
+{
+  CeresBlocks blocks;
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, false);
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->pts.resize(1);
+  EXPECT_EQ(-1, camera->camera_id_);
+  blocks.addStaticCamera(camera);
+  blocks.addMovingTarget(target, 3);
+  EXPECT_EQ(0, camera->camera_id_);
+  EXPECT_EQ(1, blocks.getNameId("target"));
+  EXPECT_EQ(2, blocks.getNameTable().size());
+  EXPECT_EQ(std::string("target"), blocks.getNameTable().name(1));
+  EXPECT_EQ(-1, blocks.getNameTable().find("other"));
+
+  // ids survive clearing the blocks, and both lookups find the same parameters
+  blocks.clearCamerasTargets();
+  blocks.addMovingTarget(target, 3);
+  EXPECT_EQ(1, blocks.getNameId("target"));
+  EXPECT_TRUE(blocks.getMovingTargetPoseParameterBlock(1, 3) == blocks.getMovingTargetPoseParameterBlock("target", 3));
+  EXPECT_TRUE(blocks.getStaticCameraParameterBlockExtrinsics(0) == NULL);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, parameter_arena)
+{
+  ParameterArena arena(16);
+  double values[3] = { 1.0, 2.0, 3.0 };
+  P_BLOCK point = arena.allocate(3, values);
+  P_BLOCK pose = arena.allocate(6);
+  EXPECT_EQ(0u, reinterpret_cast<size_t>(point) % 16);
+  EXPECT_EQ(point + 4, pose); // blocks are adjacent apart from alignment padding
+  EXPECT_EQ(2.0, point[1]);
+  EXPECT_EQ(0.0, pose[5]);
+  P_BLOCK large = arena.allocate(100); // gets a chunk of its own
+  EXPECT_EQ(0u, reinterpret_cast<size_t>(large) % 16);
+  EXPECT_EQ(110u, arena.used());
+  EXPECT_EQ(116u, arena.capacity());
+  arena.clear();
+  EXPECT_EQ(0u, arena.used());
+  EXPECT_EQ(point, arena.allocate(3)); // memory is reused after a clear
+  EXPECT_EQ(116u, arena.capacity());
+
+  // the optimized values only reach the camera once they are stored
+  CeresBlocks blocks;
+  CameraParameters camera_parameters;
+  camera_parameters.pb_extrinsics[0] = 0.5;
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, false);
+  blocks.addStaticCamera(camera);
+  P_BLOCK extrinsics = blocks.getStaticCameraParameterBlockExtrinsics("camera");
+  EXPECT_EQ(0.5, extrinsics[0]);
+  EXPECT_EQ(extrinsics + 6, blocks.getStaticCameraParameterBlockIntrinsics("camera"));
+  extrinsics[0] = 0.25;
+  EXPECT_EQ(0.5, camera->camera_parameters_.pb_extrinsics[0]);
+  blocks.storeParameters();
+  EXPECT_EQ(0.25, camera->camera_parameters_.pb_extrinsics[0]);
+
+  // clearing drops the values which were never stored, such as those of a failed solve
+  extrinsics[0] = 0.125;
+  blocks.clearCamerasTargets();
+  EXPECT_EQ(0.25, camera->camera_parameters_.pb_extrinsics[0]);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, moving_camera_blocks)
+{
+  const int num_scenes = 200;
+  CeresBlocks blocks;
+  CameraParameters camera_parameters;
+  camera_parameters.focal_length_x = 525.0;
+  camera_parameters.position[0] = 0.5;
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, true);
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    ASSERT_TRUE(blocks.addMovingCamera(camera, scene_id));
+  }
+  EXPECT_FALSE(blocks.addMovingCamera(camera, 0));
+
+  // one set of intrinsics and 6 doubles per scene
+  P_BLOCK intrinsics = blocks.getMovingCameraParameterBlockIntrinsics("camera");
+  ASSERT_TRUE(intrinsics != NULL);
+  EXPECT_EQ(525.0, intrinsics[0]);
+  P_BLOCK first = blocks.getMovingCameraParameterBlockExtrinsics("camera", 0);
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    P_BLOCK extrinsics = blocks.getMovingCameraParameterBlockExtrinsics("camera", scene_id);
+    EXPECT_EQ(first + 6 * scene_id, extrinsics);
+    EXPECT_EQ(0.5, extrinsics[3]);
+  }
+  EXPECT_TRUE(blocks.getCameraByName("camera") == camera);
+
+  // the camera object receives the intrinsics and the pose of the latest scene
+  intrinsics[0] = 530.0;
+  blocks.getMovingCameraParameterBlockExtrinsics("camera", num_scenes - 1)[3] = 0.75;
+  blocks.storeParameters();
+  EXPECT_EQ(530.0, camera->camera_parameters_.focal_length_x);
+  EXPECT_EQ(0.75, camera->camera_parameters_.position[0]);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, moving_target_blocks)
+{
+  const int num_scenes = 50;
+  CeresBlocks blocks;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = true;
+  target->pts.resize(4);
+  target->pts[3].z = 0.25;
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    target->pose.x = scene_id;
+    ASSERT_TRUE(blocks.addMovingTarget(target, scene_id));
+  }
+
+  // every scene has its own pose while all of them share one point table
+  P_BLOCK first_pose = blocks.getMovingTargetPoseParameterBlock("target", 0);
+  P_BLOCK last_pose = blocks.getMovingTargetPoseParameterBlock("target", num_scenes - 1);
+  ASSERT_TRUE(first_pose != last_pose);
+  EXPECT_EQ(0.0, first_pose[0]);
+  EXPECT_EQ(num_scenes - 1, last_pose[0]);
+  P_BLOCK point = blocks.getMovingTargetPointParameterBlock("target", 3);
+  EXPECT_EQ(0.25, point[2]);
+
+  std::set<P_BLOCK> problem_blocks;
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    problem_blocks.insert(blocks.getMovingTargetPoseParameterBlock("target", scene_id));
+  }
+  problem_blocks.insert(point);
+  ceres::ParameterBlockOrdering ordering;
+  EXPECT_EQ(num_scenes + 1, blocks.buildSchurOrdering(problem_blocks, ordering));
+  EXPECT_EQ(schur_groups::TargetPoses, ordering.GroupId(last_pose));
+  EXPECT_EQ(schur_groups::Points, ordering.GroupId(point));
+
+  // the target object receives the pose of the latest scene
+  first_pose[0] = -1.0;
+  blocks.storeParameters();
+  EXPECT_EQ(num_scenes - 1, target->pose.x);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, observation_handoff)
+{
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_id = 3;
+  target->pts.resize(5);
+  StubCameraObserver observer;
+  Roi roi = { 0, 0, 0, 0 };
+  observer.addTarget(target, roi);
+
+  // an observer without its own swap hands the observations over through getObservations
+  CameraObservations camera_observations;
+  EXPECT_EQ(1, observer.swapObservations(camera_observations));
+  ObservationSpan observations(camera_observations);
+  ASSERT_EQ(5u, observations.size());
+  EXPECT_TRUE(observations.begin() == &camera_observations.observations[0]);
+  EXPECT_EQ(3, observations[4].target_index);
+  EXPECT_EQ(4, observations[4].point_id);
+
+  CameraObservations no_observations;
+  EXPECT_TRUE(ObservationSpan(no_observations).empty());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, sparse_scene_ids)
+{
+  // scene ids from a caljob file need not start at 0 or be consecutive
+  const int scene_ids[3] = { 100, 7, 100000 };
+  CeresBlocks blocks;
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, true);
+  for (int i = 0; i < 3; i++)
+  {
+    EXPECT_EQ(i, blocks.getSceneIndex(scene_ids[i]));
+    ASSERT_TRUE(blocks.addMovingCamera(camera, scene_ids[i]));
+  }
+  EXPECT_FALSE(blocks.addMovingCamera(camera, 7));
+  EXPECT_EQ(3, blocks.getSceneRegistry().size());
+  EXPECT_EQ(100000, blocks.getSceneRegistry().sceneId(2));
+  EXPECT_EQ(-1, blocks.getSceneRegistry().find(8));
+  EXPECT_TRUE(blocks.getMovingCameraParameterBlockExtrinsics("camera", 8) == NULL);
+  EXPECT_TRUE(blocks.getMovingCameraParameterBlockExtrinsics("camera", 100000) != NULL);
+
+  // the indexes survive clearing the blocks
+  blocks.clearCamerasTargets();
+  EXPECT_EQ(1, blocks.getSceneIndex(7));
+
+  // the store keeps the rows of each scene by index, scenes may be observed in any order
+  ObservationStore store;
+  double block[6] = { 0.0 };
+  ASSERT_TRUE(store.beginScene(2));
+  store.addObservation(0, 1, 100000, 0, block, block, block, block, 0.0, 0.0);
+  ASSERT_TRUE(store.beginScene(0));
+  store.addObservation(0, 1, 100, 0, block, block, block, block, 0.0, 0.0);
+  store.addObservation(0, 1, 100, 1, block, block, block, block, 0.0, 0.0);
+  EXPECT_FALSE(store.beginScene(2));
+  ASSERT_EQ(3, store.numScenes());
+  EXPECT_EQ(1, store.sceneBegin(0));
+  EXPECT_EQ(3, store.sceneEnd(0));
+  EXPECT_EQ(store.sceneBegin(1), store.sceneEnd(1));
+  EXPECT_EQ(1, store.sceneEnd(2));
+
+  // a discarded scene leaves no rows behind and may be observed again
+  store.discardScene();
+  EXPECT_EQ(1, store.size());
+  EXPECT_EQ(store.sceneBegin(0), store.sceneEnd(0));
+  EXPECT_EQ(1, store.sceneEnd(2));
+  ASSERT_TRUE(store.beginScene(0));
+  store.addObservation(0, 1, 100, 0, block, block, block, block, 0.0, 0.0);
+  EXPECT_EQ(1, store.sceneBegin(0));
+  EXPECT_EQ(2, store.sceneEnd(0));
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, concurrent_triggering)
+{
+  // the cameras of a scene only meet if none of them waits for another one's trigger to return
+  const int num_cameras = 4;
+  TriggerRendezvous rendezvous;
+  rendezvous.expected = num_cameras;
+  rendezvous.waiting = 0;
+  rendezvous.met = false;
+  ObservingCalibrationJob job;
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = false;
+  target->pts.resize(1);
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  ObservationScene scene(trigger, 0);
+  for (int i = 0; i < num_cameras; i++)
+  {
+    std::stringstream camera_name;
+    camera_name<<"camera_"<<i;
+    boost::shared_ptr<Camera> camera = boost::make_shared<Camera>(camera_name.str(), camera_parameters, false);
+    camera->camera_observer_ = boost::make_shared<RendezvousCameraObserver>(&rendezvous);
+    scene.populateObsCmdList(camera, target, roi);
+    scene.addCameraToScene(camera);
+  }
+  job.addScene(scene);
+
+  EXPECT_TRUE(job.runObservations());
+  EXPECT_TRUE(rendezvous.met);
+  EXPECT_EQ(num_cameras, job.getObservationStore().size());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, camera_timeout)
+{
+  ObservingCalibrationJob job;
+  job.setCameraTimeout(0.1);
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = false;
+  target->pts.resize(1);
+  boost::shared_ptr<GatedCameraObserver> observer = boost::make_shared<GatedCameraObserver>();
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, false);
+  camera->camera_observer_ = observer;
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  ObservationScene scene(trigger, 0);
+  scene.populateObsCmdList(camera, target, roi);
+  scene.addCameraToScene(camera);
+  job.addScene(scene);
+
+  // the scene gives up on the blocked camera and is not retried while the camera is still inside its trigger
+  EXPECT_FALSE(job.runObservations());
+  ASSERT_EQ(1, job.numPendingTriggers());
+  boost::shared_ptr<TriggerCompletion> pending = job.getPendingTrigger(observer.get());
+  EXPECT_EQ(trigger_results::Pending, pending->result());
+  EXPECT_FALSE(job.runObservations());
+  EXPECT_EQ(0, job.getObservationStore().size());
+
+  // once the old trigger returns the camera is triggered again
+  observer->open();
+  EXPECT_EQ(trigger_results::Done, pending->wait(boost::get_system_time() + boost::posix_time::seconds(2)));
+  EXPECT_TRUE(job.runObservations());
+  EXPECT_EQ(0, job.numPendingTriggers());
+  EXPECT_EQ(1, job.getObservationStore().size());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, pending_camera_not_reconfigured)
+{
+  // both scenes use the blocked camera, the second one may neither be acquired while the first is in flight
+  // nor once the first has given up on the camera
+  ObservingCalibrationJob job;
+  job.setCameraTimeout(0.1);
+  job.setPipelineDepth(2);
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = false;
+  target->pts.resize(1);
+  boost::shared_ptr<GatedCameraObserver> observer = boost::make_shared<GatedCameraObserver>();
+  boost::shared_ptr<Camera> camera = boost::make_shared<Camera>("camera", camera_parameters, false);
+  camera->camera_observer_ = observer;
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  for (int scene_id = 0; scene_id < 2; scene_id++)
+  {
+    ObservationScene scene(trigger, scene_id);
+    scene.populateObsCmdList(camera, target, roi);
+    scene.addCameraToScene(camera);
+    job.addScene(scene);
+  }
+
+  EXPECT_FALSE(job.runObservations());
+  EXPECT_FALSE(job.runObservations());
+  EXPECT_FALSE(observer->reconfiguredWhileTriggering());
+
+  // the blocked trigger returns once the gate opens
+  ASSERT_EQ(1, job.numPendingTriggers());
+  boost::shared_ptr<TriggerCompletion> pending = job.getPendingTrigger(observer.get());
+  observer->open();
+  EXPECT_EQ(trigger_results::Done, pending->wait(boost::get_system_time() + boost::posix_time::seconds(2)));
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, pipelined_scenes)
+{
+  // the detection of the first scene only finishes early if the second scene is triggered during it
+  TriggerCompletion second_triggered;
+  boost::shared_ptr<WaitingCameraObserver> first_observer = boost::make_shared<WaitingCameraObserver>(&second_triggered);
+  ObservingCalibrationJob job;
+  job.setPipelineDepth(2);
+  CameraParameters camera_parameters;
+  boost::shared_ptr<Target> target = boost::make_shared<Target>();
+  target->target_name = "target";
+  target->is_moving = false;
+  target->pts.resize(3);
+  boost::shared_ptr<Camera> cameras[2];
+  cameras[0] = boost::make_shared<Camera>("first_camera", camera_parameters, false);
+  cameras[0]->camera_observer_ = first_observer;
+  cameras[1] = boost::make_shared<Camera>("second_camera", camera_parameters, false);
+  cameras[1]->camera_observer_ = boost::make_shared<SignallingCameraObserver>(&second_triggered);
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  for (int scene_id = 0; scene_id < 2; scene_id++)
+  {
+    ObservationScene scene(trigger, scene_id);
+    scene.populateObsCmdList(cameras[scene_id], target, roi);
+    scene.addCameraToScene(cameras[scene_id]);
+    job.addScene(scene);
+  }
+
+  EXPECT_TRUE(job.runObservations());
+  EXPECT_TRUE(first_observer->overlapped_);
+  // the scenes are still registered in order
+  ASSERT_EQ(6, job.getObservationStore().size());
+  EXPECT_EQ(0, job.getObservationStore().sceneBegin(0));
+  EXPECT_EQ(3, job.getObservationStore().sceneBegin(1));
+  EXPECT_EQ(cameras[0]->camera_id_, job.getObservationStore().cameraId(0));
+  EXPECT_EQ(cameras[1]->camera_id_, job.getObservationStore().cameraId(3));
+}
+
+/*! @brief runs a job in which cameras 0 and 1 see one target and cameras 2 and 3 another one
+ *  @param mode the optimization mode
+ *  @param job the job to run
+ *  @param truth the true pose of each camera
+ *  @param num_scenes every scene repeats the same views
+ */
+void runTwoGroupJob(OptimizationMode mode, ObservingCalibrationJob &job, const double truth[4][6],
+                    int num_scenes = 1)
+{
+  boost::shared_ptr<Target> targets[2] = { makeGridTarget("left_target", 4, 3), makeGridTarget("right_target", 4, 3) };
+  boost::shared_ptr<Camera> cameras[4];
+  for (int i = 0; i < 4; i++)
+  {
+    std::ostringstream name;
+    name<<"camera"<<i;
+    cameras[i] = makeProjectingCamera(name.str(), truth[i], 0.02);
+  }
+  Trigger trigger;
+  Roi roi = { 0, 0, 0, 0 };
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    ObservationScene scene(trigger, scene_id);
+    for (int i = 0; i < 4; i++)
+    {
+      scene.populateObsCmdList(cameras[i], targets[i / 2], roi);
+      scene.addCameraToScene(cameras[i]);
+    }
+    job.addScene(scene);
+  }
+  job.setOptimizationMode(mode);
+  job.setNumThreads(2);
+  EXPECT_TRUE(job.run());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, component_solve)
+{
+  // the targets are held constant, so no camera shares a free block with another one, each camera is solved as
+  // its own component with the SingleSolve result
+  const double truth[4][6] = { { 0.1, -0.05, 0.02, -0.05, -0.03, 1.0 }, { -0.1, 0.05, 0.0, 0.02, -0.05, 1.1 },
+                               { 0.0, 0.1, -0.03, -0.04, 0.01, 0.9 }, { 0.05, 0.0, 0.1, 0.0, -0.02, 1.2 } };
+  ObservingCalibrationJob single_job;
+  runTwoGroupJob(optimization_modes::SingleSolve, single_job, truth);
+  ObservingCalibrationJob component_job;
+  runTwoGroupJob(optimization_modes::ComponentSolve, component_job, truth);
+
+  std::vector<ProblemComponent> components;
+  component_job.partitionObservations(components);
+  ASSERT_EQ(4, components.size());
+  for (int i = 0; i < 4; i++)
+  {
+    EXPECT_EQ(12, components[i].observations.size());
+  }
+  EXPECT_EQ(4, component_job.getNumSolves());
+
+  std::vector<P_BLOCK> single_extrinsics = single_job.getExtrinsics();
+  std::vector<P_BLOCK> component_extrinsics = component_job.getExtrinsics();
+  ASSERT_EQ(4, single_extrinsics.size());
+  ASSERT_EQ(4, component_extrinsics.size());
+  for (int i = 0; i < 4; i++)
+  {
+    for (int k = 0; k < 6; k++)
+    {
+      EXPECT_NEAR(truth[i][k], single_extrinsics[i][k], 1e-6);
+      EXPECT_NEAR(single_extrinsics[i][k], component_extrinsics[i][k], 1e-6);
+    }
+  }
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, optimization_modes_benchmark)
+{
+  // the legacy mode solves the growing problem once per camera in every scene, the single solve once
+  const double truth[4][6] = { { 0.1, -0.05, 0.02, -0.05, -0.03, 1.0 }, { -0.1, 0.05, 0.0, 0.02, -0.05, 1.1 },
+                               { 0.0, 0.1, -0.03, -0.04, 0.01, 0.9 }, { 0.05, 0.0, 0.1, 0.0, -0.02, 1.2 } };
+  const int num_scenes = 8;
+  ObservingCalibrationJob per_scene_job;
+  runTwoGroupJob(optimization_modes::PerSceneSolve, per_scene_job, truth, num_scenes);
+  ObservingCalibrationJob single_job;
+  runTwoGroupJob(optimization_modes::SingleSolve, single_job, truth, num_scenes);
+  std::cout<<"PerSceneSolve "<<per_scene_job.getNumSolves()<<" solves, build: "<<per_scene_job.getBuildTime()
+      <<"s solve: "<<per_scene_job.getSolveTime()<<"s SingleSolve "<<single_job.getNumSolves()<<" solve, build: "
+      <<single_job.getBuildTime()<<"s solve: "<<single_job.getSolveTime()<<"s"<<std::endl;
+  EXPECT_EQ(4 * num_scenes, per_scene_job.getNumSolves());
+  EXPECT_EQ(1, single_job.getNumSolves());
+
+  // a repeated run starts from a fresh problem, so it solves the same number of residual blocks
+  EXPECT_TRUE(per_scene_job.run());
+  EXPECT_EQ(4 * num_scenes, per_scene_job.getNumSolves());
+
+  std::vector<P_BLOCK> per_scene_extrinsics = per_scene_job.getExtrinsics();
+  std::vector<P_BLOCK> single_extrinsics = single_job.getExtrinsics();
+  ASSERT_EQ(4 * num_scenes, per_scene_extrinsics.size());
+  ASSERT_EQ(4 * num_scenes, single_extrinsics.size());
+  for (int i = 0; i < 4 * num_scenes; i++)
+  {
+    for (int k = 0; k < 6; k++)
+    {
+      EXPECT_NEAR(truth[i % 4][k], per_scene_extrinsics[i][k], 1e-6);
+      EXPECT_NEAR(truth[i % 4][k], single_extrinsics[i][k], 1e-6);
+    }
+  }
+}
+
+/*! @brief adds one scene per target pose to a job, in each a static camera sees a moving target at that pose,
+ *         the camera pose starts off the truth and every target pose starts at the origin */
+void addMovingTargetScenes(ObservingCalibrationJob &job, const double truth[6],
+                           const std::vector<std::vector<double> > &target_poses)
+{
+  boost::shared_ptr<Target> target = makeGridTarget("target", 4, 3);
+  target->is_moving = true;
+  boost::shared_ptr<Camera> camera = makeProjectingCamera("camera", truth, 0.02);
+  camera->camera_observer_ = boost::make_shared<MovingTargetCameraObserver>(truth, camera->camera_parameters_,
+                                                                           target_poses);
+  Roi roi = { 0, 0, 0, 0 };
+  for (int scene_id = 0; scene_id < target_poses.size(); scene_id++)
+  {
+    ObservationScene scene(Trigger(), scene_id);
+    scene.populateObsCmdList(camera, target, roi);
+    scene.addCameraToScene(camera);
+    job.addScene(scene);
+  }
+  job.setOptimizationMode(optimization_modes::SingleSolve);
+  job.setPipelineDepth(1);
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, estimated_target_poses)
+{
+  // a static camera sees a moving target in four scenes, the target pose of the first scene anchors the frame and
+  // the poses of the other scenes are solved with the camera under the explicit Schur ordering
+  const int num_scenes = 4;
+  const double truth[6] = { 0.1, -0.05, 0.02, -0.05, -0.03, 1.0 };
+  std::vector<std::vector<double> > target_poses(num_scenes, std::vector<double>(6, 0.0));
+  for (int scene_id = 1; scene_id < num_scenes; scene_id++)
+  {
+    target_poses[scene_id][0] = 0.02 * scene_id;
+    target_poses[scene_id][2] = -0.01 * scene_id;
+    target_poses[scene_id][5] = 0.03 * scene_id;
+  }
+  ObservingCalibrationJob job;
+  addMovingTargetScenes(job, truth, target_poses);
+  job.setEstimateTargetPoses(true);
+  ASSERT_TRUE(job.run());
+  EXPECT_TRUE(job.usedSchurOrdering());
+
+  std::vector<P_BLOCK> extrinsics = job.getExtrinsics();
+  std::vector<P_BLOCK> poses = job.getTargetPose();
+  ASSERT_EQ(num_scenes, extrinsics.size());
+  ASSERT_EQ(num_scenes, poses.size());
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    for (int k = 0; k < 6; k++)
+    {
+      EXPECT_NEAR(truth[k], extrinsics[scene_id][k], 1e-6);
+      EXPECT_NEAR(target_poses[scene_id][k], poses[scene_id][k], 1e-6);
+    }
+  }
+
+  // the anchored pose of the first scene is constant and has no covariance, the estimated ones do
+  ASSERT_TRUE(job.computeResultCovariance());
+  const std::vector<std::vector<double> > &pose_covariances = job.getTargetPoseCovariance();
+  ASSERT_EQ(num_scenes, pose_covariances.size());
+  ASSERT_EQ(num_scenes, job.getExtrinsicsCovariance().size());
+  for (int scene_id = 0; scene_id < num_scenes; scene_id++)
+  {
+    for (int k = 0; k < 6; k++)
+    {
+      EXPECT_GT(job.getExtrinsicsCovariance()[scene_id][7 * k], 0.0);
+      if (scene_id == 0)
+      {
+        EXPECT_EQ(0.0, pose_covariances[scene_id][7 * k]);
+      }
+      else
+      {
+        EXPECT_GT(pose_covariances[scene_id][7 * k], 0.0);
+      }
+    }
+  }
+
+  // observing again reuses the memory of the blocks, the results of the previous solve are dropped with them
+  ASSERT_TRUE(job.runObservations());
+  EXPECT_TRUE(job.getExtrinsics().empty());
+  EXPECT_TRUE(job.getTargetPose().empty());
+  EXPECT_TRUE(job.getExtrinsicsCovariance().empty());
+  EXPECT_TRUE(job.getTargetPoseCovariance().empty());
+  EXPECT_FALSE(job.hasSolution());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, job_solver_plan)
+{
+  // the job plans from its own problem: constant target poses leave nothing to eliminate, estimated ones are
+  // eliminated by a Schur solver, also when the candidates are timed
+  const double truth[6] = { 0.1, -0.05, 0.02, -0.05, -0.03, 1.0 };
+  std::vector<std::vector<double> > target_poses(3, std::vector<double>(6, 0.0));
+
+  ObservingCalibrationJob constant_job;
+  addMovingTargetScenes(constant_job, truth, target_poses);
+  ASSERT_TRUE(constant_job.run());
+  EXPECT_EQ(ceres::DENSE_QR, constant_job.getLinearSolverType());
+  EXPECT_FALSE(constant_job.usedSchurOrdering());
+
+  ObservingCalibrationJob planned_job;
+  addMovingTargetScenes(planned_job, truth, target_poses);
+  planned_job.setEstimateTargetPoses(true);
+  ASSERT_TRUE(planned_job.run());
+  EXPECT_EQ(ceres::DENSE_SCHUR, planned_job.getLinearSolverType());
+  EXPECT_TRUE(planned_job.usedSchurOrdering());
+
+  ObservingCalibrationJob tuned_job;
+  addMovingTargetScenes(tuned_job, truth, target_poses);
+  tuned_job.setEstimateTargetPoses(true);
+  tuned_job.setAutoTuneSolver(true);
+  ASSERT_TRUE(tuned_job.run());
+  ceres::LinearSolverType tuned = tuned_job.getLinearSolverType();
+  EXPECT_TRUE(tuned == ceres::DENSE_SCHUR || tuned == ceres::SPARSE_SCHUR || tuned == ceres::ITERATIVE_SCHUR);
+  EXPECT_TRUE(tuned_job.usedSchurOrdering());
+  for (int k = 0; k < 6; k++)
+  {
+    EXPECT_NEAR(truth[k], tuned_job.getExtrinsics()[0][k], 1e-6);
+  }
+
+  // both jobs are cached under the same empty job file name, the structure keeps them apart
+  ObservingCalibrationJob tuned_constant_job;
+  addMovingTargetScenes(tuned_constant_job, truth, target_poses);
+  tuned_constant_job.setAutoTuneSolver(true);
+  ASSERT_TRUE(tuned_constant_job.run());
+  tuned = tuned_constant_job.getLinearSolverType();
+  EXPECT_TRUE(tuned == ceres::DENSE_QR || tuned == ceres::DENSE_NORMAL_CHOLESKY
+              || tuned == ceres::SPARSE_NORMAL_CHOLESKY);
+  EXPECT_FALSE(tuned_constant_job.usedSchurOrdering());
+}
+
+/*! @brief pixel location of a target point seen from a camera pose, as reported by ProjectingCameraObserver */
+void projectPoint(const double extrinsics[6], const double point[3], double &image_x, double &image_y)
+{
+  double camera_point[3];
+  ceres::AngleAxisRotatePoint(extrinsics, point, camera_point);
+  image_x = 525.0 * (camera_point[0] + extrinsics[3]) / (camera_point[2] + extrinsics[5]) + 320.0;
+  image_y = 525.0 * (camera_point[1] + extrinsics[4]) / (camera_point[2] + extrinsics[5]) + 240.0;
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, result_covariance)
+{
+  // with exact observations and constant targets the covariance of a camera is the inverse of J'J of its own
+  // reprojections, J is formed here by central differences of the projection
+  boost::shared_ptr<Target> target = makeGridTarget("target", 6, 5);
+  const int camera_counts[] = { 1, 4, 16, 64 };
+  for (int n = 0; n < 4; n++)
+  {
+    const int num_cameras = camera_counts[n];
+    std::vector<std::vector<double> > truth(num_cameras, std::vector<double>(6));
+    ObservationScene scene(Trigger(), 0);
+    Roi roi = { 0, 0, 0, 0 };
+    for (int i = 0; i < num_cameras; i++)
+    {
+      const double pose[6] = { 0.02 * (i % 5) - 0.04, 0.01 * (i % 3), 0.03 * (i % 2), -0.05 + 0.005 * (i % 7), -0.03,
+                               1.0 + 0.01 * i };
+      std::copy(pose, pose + 6, truth[i].begin());
+      std::ostringstream name;
+      name<<"camera"<<i;
+      boost::shared_ptr<Camera> camera = makeProjectingCamera(name.str(), pose, 0.01);
+      scene.populateObsCmdList(camera, target, roi);
+      scene.addCameraToScene(camera);
+    }
+    ObservingCalibrationJob job;
+    job.addScene(scene);
+    job.setOptimizationMode(optimization_modes::SingleSolve);
+    job.setNumThreads(2);
+    ASSERT_TRUE(job.run());
+    ASSERT_TRUE(job.computeResultCovariance());
+    std::cout<<num_cameras<<" cameras, covariance: "<<job.getCovarianceTime()<<"s"<<std::endl;
+
+    const std::vector<std::vector<double> > &covariances = job.getExtrinsicsCovariance();
+    ASSERT_EQ(num_cameras, covariances.size());
+    for (int i = 0; i < num_cameras; i++)
+    {
+      Eigen::MatrixXd jacobian(2 * target->num_points, 6);
+      for (int k = 0; k < 6; k++)
+      {
+        const double step = 1e-6;
+        double plus[6], minus[6];
+        std::copy(truth[i].begin(), truth[i].end(), plus);
+        std::copy(truth[i].begin(), truth[i].end(), minus);
+        plus[k] += step;
+        minus[k] -= step;
+        for (int j = 0; j < target->num_points; j++)
+        {
+          double plus_x, plus_y, minus_x, minus_y;
+          projectPoint(plus, target->pts[j].pb, plus_x, plus_y);
+          projectPoint(minus, target->pts[j].pb, minus_x, minus_y);
+          jacobian(2 * j, k) = (plus_x - minus_x) / (2.0 * step);
+          jacobian(2 * j + 1, k) = (plus_y - minus_y) / (2.0 * step);
+        }
+      }
+      Eigen::MatrixXd expected = (jacobian.transpose() * jacobian).inverse();
+      const double tolerance = 1e-3 * expected.cwiseAbs().maxCoeff();
+      for (int r = 0; r < 6; r++)
+      {
+        for (int c = 0; c < 6; c++)
+        {
+          EXPECT_NEAR(expected(r, c), covariances[i][6 * r + c], tolerance);
+        }
+      }
+    }
+  }
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, failed_run)
+{
+  // a job without observations cannot be solved, the cold start of an incremental run reports the failure
+  ObservingCalibrationJob job;
+  job.setOptimizationMode(optimization_modes::SingleSolve);
+  EXPECT_FALSE(job.run());
+  EXPECT_FALSE(job.runIncremental());
+  EXPECT_FALSE(job.hasSolution());
+}
+
+TEST(IndustrialExtrinsicCalCeresSuite, incremental_scenes)
+{
+  // appending the same file again adds a fresh scene, only that scene is triggered and the solve starts from
+  // the blocks which hold the first solution
+  const double truth[2][6] = { { 0.1, -0.05, 0.02, -0.05, -0.03, 1.0 }, { -0.1, 0.05, 0.0, 0.02, -0.05, 1.1 } };
+  ObservingCalibrationJob job;
+  job.setOptimizationMode(optimization_modes::SingleSolve);
+  job.setNumThreads(2);
+  job.defineTarget(makeGridTarget("target", 4, 3));
+  boost::shared_ptr<CountingCameraObserver> observers[2];
+  for (int i = 0; i < 2; i++)
+  {
+    std::ostringstream name;
+    name<<"camera"<<i;
+    boost::shared_ptr<Camera> camera = makeProjectingCamera(name.str(), truth[i], 0.02);
+    observers[i] = boost::make_shared<CountingCameraObserver>(truth[i], camera->camera_parameters_);
+    camera->camera_observer_ = observers[i];
+    job.defineCamera(camera);
+  }
+  const std::string caljob_fn = "incremental_scenes_caljob.yaml";
+  {
+    std::ofstream caljob_file(caljob_fn.c_str());
+    caljob_file<<"---\nreference_frame: world_frame\nscenes:\n-\n  scene_id: 0\n  trigger_type: 0\n  observations:\n";
+    for (int i = 0; i < 2; i++)
+    {
+      caljob_file<<"  -\n    camera: camera"<<i<<"\n    target: target\n"
+          <<"    roi_x_min: 0\n    roi_x_max: 640\n    roi_y_min: 0\n    roi_y_max: 480\n";
+    }
+    caljob_file<<"optimization_parameters: xx\n";
+  }
+
+  ASSERT_TRUE(job.appendScenes(caljob_fn));
+  EXPECT_TRUE(job.run());
+  ASSERT_TRUE(job.hasSolution());
+  EXPECT_EQ(1, observers[0]->numTriggers());
+  EXPECT_EQ(1, observers[1]->numTriggers());
+  EXPECT_EQ(2 * 12, job.getObservationStore().size());
+  ASSERT_FALSE(job.getSolverMonitor().getRecords().empty());
+  EXPECT_GT(job.getSolverMonitor().getRecords().front().cost, 1.0);
+  double first_cost = job.getSolverMonitor().getRecords().back().cost;
+  std::vector<P_BLOCK> first_extrinsics = job.getExtrinsics();
+  ASSERT_EQ(2, first_extrinsics.size());
+
+  ASSERT_TRUE(job.appendScenes(caljob_fn));
+  std::remove(caljob_fn.c_str());
+  EXPECT_TRUE(job.runIncremental());
+  // the first scene is not triggered again, its observations are kept ahead of those of the new scene 1
+  EXPECT_EQ(2, observers[0]->numTriggers());
+  EXPECT_EQ(2, observers[1]->numTriggers());
+  const ObservationStore &store = job.getObservationStore();
+  ASSERT_EQ(2 * 2 * 12, store.size());
+  EXPECT_EQ(0, store.sceneId(0));
+  EXPECT_EQ(2 * 12, store.sceneBegin(1));
+  EXPECT_EQ(1, store.sceneId(store.sceneBegin(1)));
+  // the static cameras keep their blocks, which already hold the solution when the solve starts, the new scene
+  // repeats the first one so it starts at twice the cost the first solve ended with
+  ASSERT_FALSE(job.getSolverMonitor().getRecords().empty());
+  EXPECT_NEAR(2.0 * first_cost, job.getSolverMonitor().getRecords().front().cost, 1e-9 + 1e-6 * first_cost);
+  std::vector<P_BLOCK> extrinsics = job.getExtrinsics();
+  ASSERT_EQ(4, extrinsics.size());
+  for (int i = 0; i < 2; i++)
+  {
+    EXPECT_EQ(first_extrinsics[i], extrinsics[i]);
+    for (int k = 0; k < 6; k++)
+    {
+      EXPECT_NEAR(truth[i][k], extrinsics[i][k], 1e-6);
+    }
+  }
+}
+
+void compareCostFunctions(ceres::CostFunction* expected, ceres::CostFunction* actual, std::vector<double*> &blocks)
+{
+  const std::vector<ceres::int32> &sizes = expected->parameter_block_sizes();
+  ASSERT_EQ(sizes.size(), blocks.size());
+  ASSERT_EQ(sizes.size(), actual->parameter_block_sizes().size());
+
+  std::vector<std::vector<double> > expected_jacobians(sizes.size());
+  std::vector<std::vector<double> > actual_jacobians(sizes.size());
+  std::vector<double*> expected_ptrs(sizes.size());
+  std::vector<double*> actual_ptrs(sizes.size());
+  for (int b = 0; b < sizes.size(); b++)
+  {
+    expected_jacobians[b].resize(2 * sizes[b]);
+    actual_jacobians[b].resize(2 * sizes[b]);
+    expected_ptrs[b] = &expected_jacobians[b][0];
+    actual_ptrs[b] = &actual_jacobians[b][0];
+  }
+  double expected_resid[2];
+  double actual_resid[2];
+  EXPECT_TRUE(expected->Evaluate(&blocks[0], expected_resid, &expected_ptrs[0]));
+  EXPECT_TRUE(actual->Evaluate(&blocks[0], actual_resid, &actual_ptrs[0]));
+
+  EXPECT_NEAR(expected_resid[0], actual_resid[0], 1e-9);
+  EXPECT_NEAR(expected_resid[1], actual_resid[1], 1e-9);
+  for (int b = 0; b < sizes.size(); b++)
+  {
+    for (int k = 0; k < 2 * sizes[b]; k++)
+    {
+      EXPECT_NEAR(expected_jacobians[b][k], actual_jacobians[b][k], 1e-6 * (1.0 + fabs(expected_jacobians[b][k])));
+    }
+  }
+  delete expected;
+  delete actual;
+}
+
+double evaluationsPerSecond(ceres::CostFunction* cost_function, std::vector<double*> &blocks)
+{
+  const std::vector<ceres::int32> &sizes = cost_function->parameter_block_sizes();
+  std::vector<std::vector<double> > jacobians(sizes.size());
+  std::vector<double*> jacobian_ptrs(sizes.size());
+  for (int b = 0; b < sizes.size(); b++)
+  {
+    jacobians[b].resize(2 * sizes[b]);
+    jacobian_ptrs[b] = &jacobians[b][0];
+  }
+  double resid[2];
+  const int num_evaluations = 200000;
+  ros::WallTime start = ros::WallTime::now();
+  for (int i = 0; i < num_evaluations; i++)
+  {
+    blocks[0][3] += 1e-12; // keep the compiler from hoisting the evaluation out of the loop
+    cost_function->Evaluate(&blocks[0], resid, &jacobian_ptrs[0]);
+  }
+  double elapsed = (ros::WallTime::now() - start).toSec();
+  return num_evaluations / std::max(elapsed, 1e-9);
+}
+
 Point3d transformPoint(Point3d &original_point, double &ax, double &ay, double &az, double &x, double&y, double &z)
 {
   //std::cout<<"ange axis inputs ax, ay, az: "<<ax<<", "<<ay<<", "<<az<<std::endl;